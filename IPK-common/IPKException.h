@@ -1,7 +1,12 @@
+/**
+ * Project: IPK - Projects 1 and 2 (2014) - shared networking library
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
 #ifndef IPK_EXCEPTION_H
 #define IPK_EXCEPTION_H
 
 #include <exception>
+#include <string>
 
 class IPKException : public std::exception
 {
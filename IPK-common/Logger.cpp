@@ -0,0 +1,252 @@
+/**
+ * Project: IPK - Projects 1 and 2 (2014) - shared networking library
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+#include <sys/syscall.h>
+#include "Logger.h"
+#include "IPKException.h"
+
+// single producer (the owning thread) and single consumer (the flusher), positions only grow and wrap around
+struct LogRing
+{
+    LogRing() : head(0), tail(0), abandoned(false), threadId(0) { }
+
+    LogRecord records[LOG_RING_SIZE];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic_bool abandoned;
+    uint32_t threadId;
+};
+
+// marks the ring of the finished thread, flusher recycles it once it is drained
+struct LogRingOwner
+{
+    ~LogRingOwner()
+    {
+        if (ring)
+            ring->abandoned.store(true, std::memory_order_release);
+    }
+
+    std::shared_ptr<LogRing> ring;
+};
+
+static std::atomic_bool s_running(false);
+static std::atomic<uint64_t> s_dropped(0);
+static int s_logFd = -1;
+static bool s_binary = false;
+static std::thread s_flusher;
+static std::mutex s_stopMutex;
+static std::condition_variable s_stopCondition;
+static std::mutex s_ringsMutex;
+static std::vector<std::shared_ptr<LogRing>> s_rings;
+static std::vector<std::shared_ptr<LogRing>> s_freeRings;
+static thread_local LogRingOwner t_ringOwner;
+static thread_local uint64_t t_sessionId = 0;
+
+static const char* const levelNames[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+static LogRing* GetThreadRing()
+{
+    if (!t_ringOwner.ring)
+    {
+        // the only lock on the way, once per thread
+        std::lock_guard<std::mutex> lock(s_ringsMutex);
+        if (!s_freeRings.empty())
+        {
+            t_ringOwner.ring = s_freeRings.back();
+            s_freeRings.pop_back();
+            t_ringOwner.ring->abandoned = false;
+        }
+        else
+            t_ringOwner.ring = std::make_shared<LogRing>();
+
+        t_ringOwner.ring->threadId = syscall(SYS_gettid);
+        s_rings.push_back(t_ringOwner.ring);
+    }
+
+    return t_ringOwner.ring.get();
+}
+
+static void FormatRecord(const LogRecord& record, std::string& output)
+{
+    time_t seconds = record.time / 1000000000;
+    tm localTime;
+    localtime_r(&seconds, &localTime);
+
+    char timeStr[32];
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &localTime);
+
+    char line[LOG_MESSAGE_SIZE + 192];
+    snprintf(line, sizeof(line), "%s.%06u %-7s session=%llu thread=%u opcode=%u bytes=%llu duration=%lluus %s\n", timeStr,
+        (uint32_t)(record.time % 1000000000 / 1000), record.level < LOG_LEVEL_NONE ? levelNames[record.level] : "?",
+        (unsigned long long)record.sessionId, record.threadId, record.opcode, (unsigned long long)record.bytes,
+        (unsigned long long)record.duration, record.message);
+    output += line;
+}
+
+static void WriteOutput(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t res = write(s_logFd, data, length);
+        if (res == -1 && errno == EINTR)
+            continue;
+
+        if (res <= 0)
+            return;
+
+        data += res;
+        length -= res;
+    }
+}
+
+// drains all the rings, records of the different threads are put in order of their time
+static void Flush()
+{
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(s_ringsMutex);
+        rings = s_rings;
+    }
+
+    std::vector<LogRecord> records;
+    for (std::shared_ptr<LogRing>& ring : rings)
+    {
+        // abandoned flag is read first, its thread can't add anything after it then
+        bool abandoned = ring->abandoned.load(std::memory_order_acquire);
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail)
+            records.push_back(ring->records[tail % LOG_RING_SIZE]);
+
+        ring->tail.store(tail, std::memory_order_release);
+
+        if (abandoned)
+        {
+            std::lock_guard<std::mutex> lock(s_ringsMutex);
+            s_rings.erase(std::find(s_rings.begin(), s_rings.end(), ring));
+            ring->head = 0;
+            ring->tail = 0;
+            s_freeRings.push_back(ring);
+        }
+    }
+
+    if (records.empty())
+        return;
+
+    std::stable_sort(records.begin(), records.end(), [](const LogRecord& first, const LogRecord& second)
+    {
+        return first.time < second.time;
+    });
+
+    if (s_binary)
+    {
+        WriteOutput((const char*)records.data(), records.size() * sizeof(LogRecord));
+        return;
+    }
+
+    std::string output;
+    for (const LogRecord& record : records)
+        FormatRecord(record, output);
+
+    WriteOutput(output.data(), output.length());
+}
+
+static void FlushLoop()
+{
+    std::unique_lock<std::mutex> lock(s_stopMutex);
+    while (s_running)
+    {
+        s_stopCondition.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL));
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+void Logger::Start(const std::string& path, bool binary)
+{
+    std::lock_guard<std::mutex> lock(s_stopMutex);
+    if (s_running)
+        return;
+
+    s_logFd = (path == "-") ? STDERR_FILENO : open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (s_logFd == -1)
+        throw IPKException("Logger::Start - unable to open log file");
+
+    s_binary = binary;
+    s_running = true;
+    s_flusher = std::thread(&FlushLoop);
+}
+
+void Logger::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_stopMutex);
+        if (!s_running)
+            return;
+
+        s_running = false;
+    }
+
+    s_stopCondition.notify_one();
+    s_flusher.join();
+    Flush();
+
+    if (s_logFd != STDERR_FILENO)
+        close(s_logFd);
+
+    s_logFd = -1;
+}
+
+void Logger::SetSession(uint64_t sessionId)
+{
+    t_sessionId = sessionId;
+}
+
+void Logger::Write(uint8_t level, uint8_t opcode, uint64_t bytes, uint64_t duration, const char* message)
+{
+    if (!s_running.load(std::memory_order_relaxed))
+        return;
+
+    LogRing* ring = GetThreadRing();
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE)
+    {
+        s_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRecord& record = ring->records[head % LOG_RING_SIZE];
+    record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.sessionId = t_sessionId;
+    record.bytes = bytes;
+    record.duration = duration;
+    record.threadId = ring->threadId;
+    record.level = level;
+    record.opcode = opcode;
+    record.reserved[0] = record.reserved[1] = 0;
+    strncpy(record.message, message, LOG_MESSAGE_SIZE - 1);
+    record.message[LOG_MESSAGE_SIZE - 1] = '\0';
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t Logger::GetDropped()
+{
+    return s_dropped;
+}
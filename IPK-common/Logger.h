@@ -0,0 +1,104 @@
+/**
+ * Project: IPK - Projects 1 and 2 (2014) - shared networking library
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstdint>
+#include <string>
+#include <chrono>
+
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_ERROR     3
+#define LOG_LEVEL_NONE      4
+
+// records below the level aren't compiled in at all, their arguments aren't even evaluated
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE       256
+#define LOG_MESSAGE_SIZE    88
+#define LOG_FLUSH_INTERVAL  100
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(opcode, bytes, duration, message)     Logger::Write(LOG_LEVEL_DEBUG, opcode, bytes, duration, message)
+#else
+#define LOG_DEBUG(opcode, bytes, duration, message)     ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(opcode, bytes, duration, message)      Logger::Write(LOG_LEVEL_INFO, opcode, bytes, duration, message)
+#else
+#define LOG_INFO(opcode, bytes, duration, message)      ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARNING
+#define LOG_WARNING(opcode, bytes, duration, message)   Logger::Write(LOG_LEVEL_WARNING, opcode, bytes, duration, message)
+#else
+#define LOG_WARNING(opcode, bytes, duration, message)   ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(opcode, bytes, duration, message)     Logger::Write(LOG_LEVEL_ERROR, opcode, bytes, duration, message)
+#else
+#define LOG_ERROR(opcode, bytes, duration, message)     ((void)0)
+#endif
+
+// One record as it is kept in the ring and as it is written to the binary log, 128 bytes in the host byte order
+struct LogRecord
+{
+    uint64_t time;          // nanoseconds since the epoch
+    uint64_t sessionId;     // 0 outside of the sessions
+    uint64_t bytes;
+    uint64_t duration;      // microseconds
+    uint32_t threadId;
+    uint8_t level;
+    uint8_t opcode;
+    uint8_t reserved[2];
+    char message[LOG_MESSAGE_SIZE];
+};
+
+// Every thread writes into its own ring without any locking, the background flusher drains the rings into the log
+// file. Records which don't fit into the full ring are dropped and counted rather than stalling the thread.
+class Logger
+{
+public:
+    Logger() = delete;
+    Logger(const Logger&) = delete;
+
+    // "-" logs to stderr, binary log consists of the raw records, nothing is logged until the logger is started
+    static void Start(const std::string& path, bool binary);
+    // writes out all the records logged so far
+    static void Stop();
+
+    // records logged by the calling thread carry the session id from now on
+    static void SetSession(uint64_t sessionId);
+    static void Write(uint8_t level, uint8_t opcode, uint64_t bytes, uint64_t duration, const char* message);
+    static void Write(uint8_t level, uint8_t opcode, uint64_t bytes, uint64_t duration, const std::string& message)
+    {
+        Write(level, opcode, bytes, duration, message.c_str());
+    }
+
+    static uint64_t GetDropped();
+};
+
+// measures the duration of the logged operation from its construction
+class LogTimer
+{
+public:
+    LogTimer() : m_start(std::chrono::steady_clock::now()) { }
+
+    uint64_t GetDurationUs() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // LOGGER_H
@@ -0,0 +1,263 @@
+/**
+ * Project: IPK - Projects 1 and 2 (2014) - shared networking library
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include "IPKException.h"
+
+#define RESOLVER_CACHE_TTL          60      // seconds
+#define CONNECTION_ATTEMPT_DELAY    250     // milliseconds, RFC 8305
+#define DEFAULT_CONNECT_TIMEOUT     60      // seconds
+
+struct ResolvedAddress
+{
+    sockaddr_storage address;
+    socklen_t length;
+    int family;
+};
+
+typedef std::vector<ResolvedAddress> AddressList;
+
+// called for every socket before it starts to connect, so the options can be set on it
+typedef std::function<void(int socketFd)> PrepareSocketCallback;
+
+// Name resolution through getaddrinfo() shared by all the threads. Answers are kept for RESOLVER_CACHE_TTL seconds,
+// so the repeated connections to the same host don't ask the resolver again.
+class Resolver
+{
+public:
+    // addresses are ordered to be tried one after another, IPv6 and IPv4 interleaved
+    static AddressList Resolve(const std::string& hostname, uint16_t port)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        AddressList addresses;
+        {
+            std::lock_guard<std::mutex> lock(GetCacheMutex());
+            std::map<std::string, CacheEntry>::const_iterator itr = GetCache().find(hostname);
+            if (itr != GetCache().end() && now < itr->second.expires)
+                addresses = itr->second.addresses;
+        }
+
+        // lookup itself runs without the lock, slow answer for one host doesn't block the others
+        if (addresses.empty())
+        {
+            addresses = Lookup(hostname);
+
+            std::lock_guard<std::mutex> lock(GetCacheMutex());
+            CacheEntry& entry = GetCache()[hostname];
+            entry.addresses = addresses;
+            entry.expires = now + std::chrono::seconds(RESOLVER_CACHE_TTL);
+        }
+
+        // port isn't the part of the cached answer
+        for (ResolvedAddress& address : addresses)
+        {
+            if (address.family == AF_INET6)
+                ((sockaddr_in6*)&address.address)->sin6_port = htons(port);
+            else
+                ((sockaddr_in*)&address.address)->sin_port = htons(port);
+        }
+
+        return addresses;
+    }
+
+    // Happy Eyeballs, the next address is tried whenever the previous attempts don't succeed in CONNECTION_ATTEMPT_DELAY,
+    // the first connected socket wins and is returned in blocking mode, connectedAddress is the index of its address
+    static int Connect(const AddressList& addresses, size_t& connectedAddress,
+        const PrepareSocketCallback& prepareSocket = PrepareSocketCallback(), uint32_t timeoutSecs = DEFAULT_CONNECT_TIMEOUT)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSecs);
+        std::chrono::steady_clock::time_point nextAttempt = std::chrono::steady_clock::now();
+        std::vector<pollfd> attempts;
+        std::vector<size_t> attemptAddresses;
+        size_t nextAddress = 0;
+        int connectedFd = -1;
+
+        while (connectedFd == -1)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now >= deadline || (attempts.empty() && nextAddress == addresses.size()))
+                break;
+
+            // failed attempt doesn't have to wait for the delay, the next one starts right away
+            if (nextAddress < addresses.size() && (now >= nextAttempt || attempts.empty()))
+            {
+                nextAttempt = now + std::chrono::milliseconds(CONNECTION_ATTEMPT_DELAY);
+
+                int fd;
+                try
+                {
+                    fd = StartAttempt(addresses[nextAddress], prepareSocket);
+                }
+                catch (const IPKException&)
+                {
+                    for (const pollfd& attempt : attempts)
+                        close(attempt.fd);
+
+                    throw;
+                }
+
+                if (fd == -1)
+                {
+                    ++nextAddress;
+                    continue;
+                }
+
+                pollfd attempt;
+                attempt.fd = fd;
+                attempt.events = POLLOUT;
+                attempt.revents = 0;
+                attempts.push_back(attempt);
+                attemptAddresses.push_back(nextAddress++);
+                continue;
+            }
+
+            std::chrono::steady_clock::time_point wakeUp = (nextAddress < addresses.size()) ? std::min(nextAttempt, deadline) : deadline;
+            int64_t pollTimeout = std::chrono::duration_cast<std::chrono::milliseconds>(wakeUp - now).count() + 1;
+            if (poll(attempts.data(), attempts.size(), pollTimeout) <= 0)
+                continue;
+
+            for (size_t i = 0; i < attempts.size(); )
+            {
+                if (!attempts[i].revents)
+                {
+                    ++i;
+                    continue;
+                }
+
+                int error = 0;
+                socklen_t errorLength = sizeof(error);
+                if (connectedFd == -1 && getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0)
+                {
+                    connectedFd = attempts[i].fd;
+                    connectedAddress = attemptAddresses[i];
+                }
+                else
+                    close(attempts[i].fd);
+
+                attempts.erase(attempts.begin() + i);
+                attemptAddresses.erase(attemptAddresses.begin() + i);
+            }
+        }
+
+        for (const pollfd& attempt : attempts)
+            close(attempt.fd);
+
+        if (connectedFd == -1)
+            throw IPKException("Resolver::Connect - unable to connect to the endpoint");
+
+        fcntl(connectedFd, F_SETFL, fcntl(connectedFd, F_GETFL) & ~O_NONBLOCK);
+        return connectedFd;
+    }
+
+private:
+    struct CacheEntry
+    {
+        AddressList addresses;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    static std::mutex& GetCacheMutex()
+    {
+        static std::mutex cacheMutex;
+        return cacheMutex;
+    }
+
+    static std::map<std::string, CacheEntry>& GetCache()
+    {
+        static std::map<std::string, CacheEntry> cache;
+        return cache;
+    }
+
+    static AddressList Lookup(const std::string& hostname)
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(addrinfo));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_ADDRCONFIG;
+
+        addrinfo* results = NULL;
+        if (getaddrinfo(hostname.c_str(), NULL, &hints, &results) != 0 || !results)
+            throw IPKException("Resolver::Resolve - cannot resolve hostname to IP");
+
+        // resolver gives the preferred order, families are interleaved so the fallback to the other one comes soon
+        AddressList preferred, other;
+        for (addrinfo* result = results; result; result = result->ai_next)
+        {
+            if ((result->ai_family != AF_INET && result->ai_family != AF_INET6) || result->ai_addrlen > sizeof(sockaddr_storage))
+                continue;
+
+            ResolvedAddress address;
+            memset(&address, 0, sizeof(ResolvedAddress));
+            memcpy(&address.address, result->ai_addr, result->ai_addrlen);
+            address.length = result->ai_addrlen;
+            address.family = result->ai_family;
+            (preferred.empty() || preferred[0].family == address.family ? preferred : other).push_back(address);
+        }
+
+        freeaddrinfo(results);
+        if (preferred.empty())
+            throw IPKException("Resolver::Resolve - cannot resolve hostname to IP");
+
+        AddressList addresses;
+        for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+        {
+            if (i < preferred.size())
+                addresses.push_back(preferred[i]);
+
+            if (i < other.size())
+                addresses.push_back(other[i]);
+        }
+
+        return addresses;
+    }
+
+    // returns the socket with the connection in progress, -1 if this address already failed
+    static int StartAttempt(const ResolvedAddress& address, const PrepareSocketCallback& prepareSocket)
+    {
+        int fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        if (fd == -1)
+            return -1;
+
+        try
+        {
+            if (prepareSocket)
+                prepareSocket(fd);
+        }
+        catch (const IPKException&)
+        {
+            close(fd);
+            throw;
+        }
+
+        if (connect(fd, (const sockaddr*)&address.address, address.length) != 0 && errno != EINPROGRESS)
+        {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+};
+
+#endif // RESOLVER_H
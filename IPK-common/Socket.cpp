@@ -0,0 +1,654 @@
+/**
+ * Project: IPK - Projects 1 and 2 (2014) - shared networking library
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include "Socket.h"
+#include "IPKException.h"
+
+Socket::Socket(const std::string& hostname, uint16_t port) : m_socketHandle(INVALID_SOCKET), m_family(AF_INET), m_socketAddrLen(0),
+    m_hostname(hostname), m_port(port)
+{
+    Init();
+}
+
+Socket::Socket(const std::string& path) : m_socketHandle(INVALID_SOCKET), m_family(AF_UNIX), m_socketAddrLen(0), m_hostname(path), m_port(0)
+{
+    Init();
+}
+
+Socket::Socket(int socketFd, const sockaddr_storage* socketAddr, socklen_t socketAddrLen) : m_socketHandle(socketFd),
+    m_family(socketAddr->ss_family), m_socketAddrLen(socketAddrLen), m_port(0)
+{
+    Init();
+    memcpy(&m_socketAddr, socketAddr, sizeof(sockaddr_storage));
+
+    char ipAddr[INET6_ADDRSTRLEN];
+    if (m_family == AF_INET)
+    {
+        const sockaddr_in* inetAddr = (const sockaddr_in*)socketAddr;
+        inet_ntop(AF_INET, &(inetAddr->sin_addr), ipAddr, INET6_ADDRSTRLEN);
+        m_hostname = ipAddr;
+        m_port = ntohs(inetAddr->sin_port);
+    }
+    else if (m_family == AF_INET6)
+    {
+        const sockaddr_in6* inet6Addr = (const sockaddr_in6*)socketAddr;
+        inet_ntop(AF_INET6, &(inet6Addr->sin6_addr), ipAddr, INET6_ADDRSTRLEN);
+        m_hostname = ipAddr;
+        m_port = ntohs(inet6Addr->sin6_port);
+    }
+    else // clients on the local socket are mostly unnamed
+        m_hostname = "localhost";
+}
+
+Socket::~Socket()
+{
+    while (!m_recvFdQueue.empty())
+    {
+        close(m_recvFdQueue.front());
+        m_recvFdQueue.pop();
+    }
+
+    if (m_socketHandle != INVALID_SOCKET)
+        close(m_socketHandle);
+}
+
+void Socket::Init()
+{
+    memset(&m_socketAddr, 0, sizeof(sockaddr_storage));
+    memset(&m_recvTimeout, 0, sizeof(timeval));
+    m_resolved = false;
+    m_writeTimeout = 0;
+    m_writeStalled = false;
+    m_stalledBytesSent = 0;
+    m_buffer.resize(DEFAULT_BUFFER_SIZE);
+    m_bufferStart = 0;
+    m_bufferSize = 0;
+    m_closed = false;
+    m_nonBlocking = false;
+    m_bytesSent = 0;
+    m_bytesReceived = 0;
+}
+
+void Socket::Resolve()
+{
+    // resolve hostname -> IP addresses, answers are shared by all the sockets
+    m_remoteAddresses = Resolver::Resolve(m_hostname, m_port);
+    m_resolved = true;
+}
+
+void Socket::Open()
+{
+    if (m_family == AF_UNIX)
+    {
+        sockaddr_un* unixAddr = (sockaddr_un*)&m_socketAddr;
+        if (m_hostname.length() >= sizeof(unixAddr->sun_path))
+            throw IPKException("Socket::Open - path of the local socket is too long");
+
+        unixAddr->sun_family = AF_UNIX;
+        strcpy(unixAddr->sun_path, m_hostname.c_str());
+        m_socketAddrLen = sizeof(sockaddr_un);
+    }
+    else
+    {
+        if (!m_resolved)
+            Resolve();
+
+        // the socket is created for the preferred address, Connect() may still end up on the other ones
+        const ResolvedAddress& preferred = m_remoteAddresses.front();
+        m_family = preferred.family;
+        memcpy(&m_socketAddr, &preferred.address, sizeof(sockaddr_storage));
+        m_socketAddrLen = preferred.length;
+    }
+
+    m_socketHandle = socket(m_family, SOCK_STREAM, m_family == AF_UNIX ? 0 : IPPROTO_TCP);
+    if (m_socketHandle == INVALID_SOCKET)
+        throw IPKException("Socket::Open - unable to create socket handle");
+
+    ApplyOptions(m_socketHandle);
+}
+
+void Socket::Connect()
+{
+    if (m_family == AF_UNIX || m_remoteAddresses.size() <= 1)
+    {
+        if (connect(m_socketHandle, (const sockaddr*)&m_socketAddr, m_socketAddrLen) != 0)
+            throw IPKException("Socket::Connect - unable to connect to the endpoint");
+
+        return;
+    }
+
+    // every attempt has its own socket with the same options as the one from Open(), the winner replaces it
+    size_t connectedAddress = 0;
+    int socketHandle = Resolver::Connect(m_remoteAddresses, connectedAddress, [this](int attemptFd)
+        {
+            ApplyOptions(attemptFd, true);
+        });
+
+    close(m_socketHandle);
+    m_socketHandle = socketHandle;
+
+    const ResolvedAddress& address = m_remoteAddresses[connectedAddress];
+    m_family = address.family;
+    memcpy(&m_socketAddr, &address.address, sizeof(sockaddr_storage));
+    m_socketAddrLen = address.length;
+}
+
+void Socket::Close()
+{
+    if (m_socketHandle == INVALID_SOCKET)
+        return;
+
+    // peer may have already closed the connection, shutdown is only the courtesy then
+    shutdown(m_socketHandle, SHUT_RDWR);
+    int result = close(m_socketHandle);
+    m_socketHandle = INVALID_SOCKET;
+
+    if (result != 0)
+        throw IPKException("Socket::Close - close on socket failed");
+}
+
+void Socket::Bind()
+{
+    // stale local socket left by the previous run would make bind fail
+    if (m_family == AF_UNIX)
+        unlink(m_hostname.c_str());
+
+    if (bind(m_socketHandle, (const sockaddr*)&m_socketAddr, m_socketAddrLen) != 0)
+        throw IPKException("Socket::Bind - unable to bind to the selected address and port");
+
+    // local clients can get the descriptors of the served files, so only the owner may connect, nobody can
+    // connect before Listen() anyway
+    if (m_family == AF_UNIX && chmod(m_hostname.c_str(), S_IRUSR | S_IWUSR) != 0)
+        throw IPKException("Socket::Bind - unable to restrict access to the local socket");
+}
+
+void Socket::Listen()
+{
+    if (listen(m_socketHandle, SOMAXCONN) != 0)
+        throw IPKException("Socket::Listen - unable to start listening");
+}
+
+int Socket::AcceptHandle(uint32_t timeoutSec, sockaddr_storage& sessionAddress, socklen_t& sessionAddressLen)
+{
+    pollfd acceptFd;
+    acceptFd.fd = m_socketHandle;
+    acceptFd.events = POLLIN;
+    acceptFd.revents = 0;
+
+    if (poll(&acceptFd, 1, timeoutSec * 1000) <= 0 || !(acceptFd.revents & POLLIN))
+        return INVALID_SOCKET;
+
+    sessionAddressLen = sizeof(sockaddr_storage);
+    memset(&sessionAddress, 0, sizeof(sockaddr_storage));
+    int sessionSocket = accept(m_socketHandle, (sockaddr*)&sessionAddress, &sessionAddressLen);
+    if (sessionSocket == INVALID_SOCKET)
+        throw IPKException("Socket::Accept - error occured during accept");
+
+    // unnamed unix domain peers may return only the family or nothing at all
+    sessionAddress.ss_family = m_family;
+    return sessionSocket;
+}
+
+void Socket::FillBuffer()
+{
+    int flags = 0;
+
+    while (m_bufferSize < DEFAULT_BUFFER_SIZE)
+    {
+        // free space of the ring buffer can be split in two parts, fill both at once
+        uint32_t writePos = (m_bufferStart + m_bufferSize) % DEFAULT_BUFFER_SIZE;
+        uint32_t freeSpace = DEFAULT_BUFFER_SIZE - m_bufferSize;
+        uint32_t firstPart = std::min(freeSpace, DEFAULT_BUFFER_SIZE - writePos);
+
+        iovec parts[2];
+        parts[0].iov_base = &m_buffer[writePos];
+        parts[0].iov_len = firstPart;
+        parts[1].iov_base = &m_buffer[0];
+        parts[1].iov_len = freeSpace - firstPart;
+
+        int64_t bytesRead = RecvVector(parts, parts[1].iov_len ? 2 : 1, flags);
+        if (bytesRead > 0)
+        {
+            m_bufferSize += bytesRead;
+            flags = MSG_DONTWAIT;
+            continue;
+        }
+
+        // remote endpoint closed the connection, there is nothing more to read
+        if (bytesRead == 0)
+        {
+            m_closed = true;
+            return;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            // we have read everything that was there, let the caller to decide what to do
+            if (flags == MSG_DONTWAIT || m_nonBlocking)
+                return;
+
+            // recv() timed out
+            throw IPKException("Socket::Recv - connection timed out");
+        }
+
+        // error on the socket
+        throw IPKException("Socket::Recv - error while receiving occured");
+    }
+}
+
+void Socket::RewindBuffer(uint32_t count)
+{
+    // throw out 'count' oldest bytes, nothing has to be moved
+    count = std::min(count, m_bufferSize);
+    m_bufferStart = (m_bufferStart + count) % DEFAULT_BUFFER_SIZE;
+    m_bufferSize -= count;
+
+    if (!m_bufferSize)
+        m_bufferStart = 0;
+}
+
+uint32_t Socket::GetBufferView(const uint8_t*& data) const
+{
+    data = &m_buffer[m_bufferStart];
+    return std::min(m_bufferSize, DEFAULT_BUFFER_SIZE - m_bufferStart);
+}
+
+uint32_t Socket::GetBufferSize() const
+{
+    return m_bufferSize;
+}
+
+int64_t Socket::RecvBytes(uint8_t* buffer, uint64_t bufferSize, int flags)
+{
+    iovec part;
+    part.iov_base = buffer;
+    part.iov_len = bufferSize;
+    return RecvVector(&part, 1, flags);
+}
+
+int64_t Socket::RecvVector(iovec* parts, uint32_t partCount, int flags)
+{
+    // union keeps the control buffer aligned for cmsghdr
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_RECV_DESCRIPTORS)];
+        cmsghdr align;
+    } control;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = parts;
+    msg.msg_iovlen = partCount;
+
+    if (m_family == AF_UNIX)
+    {
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        flags |= MSG_CMSG_CLOEXEC;
+    }
+
+    int64_t bytesRecvd = recvmsg(m_socketHandle, &msg, flags);
+    if (bytesRecvd <= 0)
+        return bytesRecvd;
+
+    m_bytesReceived += bytesRecvd;
+    if (m_family != AF_UNIX)
+        return bytesRecvd;
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        uint32_t fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (uint32_t i = 0; i < fdCount; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            m_recvFdQueue.push(fd);
+        }
+    }
+
+    return bytesRecvd;
+}
+
+int Socket::GetReceivedDescriptor()
+{
+    if (m_recvFdQueue.empty())
+        return -1;
+
+    int fd = m_recvFdQueue.front();
+    m_recvFdQueue.pop();
+    return fd;
+}
+
+void Socket::Send(const void* buffer, uint64_t bufferSize)
+{
+    iovec part;
+    part.iov_base = const_cast<void*>(buffer);
+    part.iov_len = bufferSize;
+    SendVector(&part, 1);
+}
+
+void Socket::SendVector(const iovec* parts, uint32_t partCount)
+{
+    std::vector<iovec> remaining(parts, parts + partCount);
+    uint32_t partIndex = 0;
+
+    // sendmsg() can send the parts in chunks, the next one continues where the previous has stopped
+    while (partIndex < partCount)
+    {
+        if (!remaining[partIndex].iov_len)
+        {
+            ++partIndex;
+            continue;
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_iov = &remaining[partIndex];
+        msg.msg_iovlen = partCount - partIndex;
+
+        int64_t bytesSent = SendMessage(msg, "Socket::Send - unable to send data");
+        for (; bytesSent > 0 && partIndex < partCount; ++partIndex)
+        {
+            if ((uint64_t)bytesSent < remaining[partIndex].iov_len)
+            {
+                remaining[partIndex].iov_base = (uint8_t*)remaining[partIndex].iov_base + bytesSent;
+                remaining[partIndex].iov_len -= bytesSent;
+                break;
+            }
+
+            bytesSent -= remaining[partIndex].iov_len;
+        }
+    }
+}
+
+int64_t Socket::SendMessage(const msghdr& msg, const char* errorMessage)
+{
+    while (true)
+    {
+        int64_t bytesSent = sendmsg(m_socketHandle, &msg, MSG_NOSIGNAL | (m_writeTimeout ? MSG_DONTWAIT : 0));
+        if (bytesSent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if ((m_writeTimeout || m_nonBlocking) && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                // deadline starts when the peer first stops keeping up and isn't moved by the single bytes it reads
+                if (m_writeTimeout && !m_writeStalled)
+                {
+                    m_writeStalled = true;
+                    m_writeDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_writeTimeout);
+                    m_stalledBytesSent = 0;
+                }
+
+                WaitWritable();
+                continue;
+            }
+
+            throw IPKException(errorMessage);
+        }
+
+        m_bytesSent += bytesSent;
+        if (m_writeStalled)
+        {
+            m_stalledBytesSent += bytesSent;
+            if (m_stalledBytesSent >= WRITE_PROGRESS_MIN_BYTES)
+                m_writeStalled = false;
+        }
+
+        return bytesSent;
+    }
+}
+
+void Socket::WaitWritable()
+{
+    int64_t remaining = -1;
+    if (m_writeTimeout)
+    {
+        remaining = std::chrono::duration_cast<std::chrono::milliseconds>(m_writeDeadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+            throw IPKException("Socket::Send - write deadline exceeded, remote endpoint doesn't read");
+    }
+
+    pollfd writeFd;
+    writeFd.fd = m_socketHandle;
+    writeFd.events = POLLOUT;
+    writeFd.revents = 0;
+    poll(&writeFd, 1, remaining);
+}
+
+void Socket::SendDescriptor(const void* buffer, uint64_t bufferSize, int fd)
+{
+    if (m_family != AF_UNIX)
+        throw IPKException("Socket::SendDescriptor - descriptors can be sent only over local socket");
+
+    iovec iov;
+    iov.iov_base = const_cast<void*>(buffer);
+    iov.iov_len = bufferSize;
+
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } control;
+    memset(control.buffer, 0, sizeof(control.buffer));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    // descriptor goes with the first byte, the rest of the data can be sent ordinarily
+    int64_t bytesSent = SendMessage(msg, "Socket::SendDescriptor - error occured during transimission");
+    if (bytesSent <= 0)
+        throw IPKException("Socket::SendDescriptor - error occured during transimission");
+
+    Send((const uint8_t*)buffer + bytesSent, bufferSize - bytesSent);
+}
+
+void Socket::SetNonBlocking(bool nonBlocking)
+{
+    int flags = fcntl(m_socketHandle, F_GETFL);
+    if (flags == -1 || fcntl(m_socketHandle, F_SETFL, nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) != 0)
+        throw IPKException("Socket::SetNonBlocking - failed to change blocking mode");
+
+    m_nonBlocking = nonBlocking;
+}
+
+void Socket::SetRecvTimeout(uint32_t timeoutSecs, uint32_t timeoutUsecs)
+{
+    m_recvTimeout.tv_sec = timeoutSecs;
+    m_recvTimeout.tv_usec = timeoutUsecs;
+
+    // socket which isn't open yet gets the timeout in Open()
+    if (m_socketHandle == INVALID_SOCKET)
+        return;
+
+    if (setsockopt(m_socketHandle, SOL_SOCKET, SO_RCVTIMEO, &m_recvTimeout, sizeof(timeval)) != 0)
+        throw IPKException("Socket::SetRecvTimeout - failed to set recv timeout");
+}
+
+void Socket::GetRecvTimeout(uint32_t& timeoutSecs, uint32_t& timeoutUsecs) const
+{
+    timeoutSecs = m_recvTimeout.tv_sec;
+    timeoutUsecs = m_recvTimeout.tv_usec;
+}
+
+void Socket::SetSendLimits(uint32_t bufferSize, uint32_t timeoutMs)
+{
+    if (bufferSize && !SetOption(SOL_SOCKET, SO_SNDBUF, bufferSize))
+        throw IPKException("Socket::SetSendLimits - failed to set send buffer size");
+
+    m_writeTimeout = timeoutMs;
+}
+
+void Socket::SetReusableAddress(bool reusable)
+{
+    if (!SetOption(SOL_SOCKET, SO_REUSEADDR, reusable))
+        throw IPKException("Socket::SetReusableAddress - failed to set reusable address");
+}
+
+void Socket::SetReusablePort(bool reusable)
+{
+    if (!SetOption(SOL_SOCKET, SO_REUSEPORT, reusable))
+        throw IPKException("Socket::SetReusablePort - failed to set reusable port");
+}
+
+void Socket::SetNoDelay(bool noDelay)
+{
+    if (m_family == AF_UNIX)
+        return;
+
+    if (!SetOption(IPPROTO_TCP, TCP_NODELAY, noDelay))
+        throw IPKException("Socket::SetNoDelay - failed to set no delay");
+}
+
+bool Socket::SetFastOpen(uint32_t queueSize)
+{
+#ifdef TCP_FASTOPEN
+    if (m_family == AF_UNIX)
+        return false;
+
+    return SetOption(IPPROTO_TCP, TCP_FASTOPEN, queueSize);
+#else
+    (void)queueSize;
+    return false;
+#endif
+}
+
+bool Socket::SetFastOpenConnect(bool fastOpen)
+{
+#ifdef TCP_FASTOPEN_CONNECT
+    if (m_family == AF_UNIX)
+        return false;
+
+    return SetOption(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, fastOpen);
+#else
+    (void)fastOpen;
+    return false;
+#endif
+}
+
+bool Socket::SetOption(int level, int name, int value)
+{
+    if (m_socketHandle != INVALID_SOCKET && setsockopt(m_socketHandle, level, name, &value, sizeof(value)) != 0)
+        return false;
+
+    for (SocketOption& option : m_options)
+    {
+        if (option.level == level && option.name == name)
+        {
+            option.value = value;
+            return true;
+        }
+    }
+
+    SocketOption option;
+    option.level = level;
+    option.name = name;
+    option.value = value;
+    m_options.push_back(option);
+    return true;
+}
+
+void Socket::ApplyOptions(int socketFd, bool connectAttempt) const
+{
+    for (const SocketOption& option : m_options)
+    {
+#ifdef TCP_FASTOPEN_CONNECT
+        // such connect returns right away before the handshake, so the first attempt would always win the race, the
+        // attempts connect the plain way and the data go only after the handshake then
+        if (connectAttempt && option.level == IPPROTO_TCP && option.name == TCP_FASTOPEN_CONNECT)
+            continue;
+#endif
+
+        if (setsockopt(socketFd, option.level, option.name, &option.value, sizeof(option.value)) != 0)
+            throw IPKException("Socket::ApplyOptions - failed to set socket option");
+    }
+
+#ifndef TCP_FASTOPEN_CONNECT
+    (void)connectAttempt;
+#endif
+
+    if ((m_recvTimeout.tv_sec || m_recvTimeout.tv_usec) && setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &m_recvTimeout, sizeof(timeval)) != 0)
+        throw IPKException("Socket::ApplyOptions - failed to set recv timeout");
+}
+
+bool Socket::IsReadyToRead(uint32_t timeoutSecs)
+{
+    pollfd readFd;
+    readFd.fd = m_socketHandle;
+    readFd.events = POLLIN;
+    readFd.revents = 0;
+
+    // wait 'timeoutSecs' if anything appears on the socket to read
+    if (poll(&readFd, 1, timeoutSecs * 1000) == 1)
+    {
+        int32_t bytes;
+        ioctl(m_socketHandle, FIONREAD, &bytes);
+        return bytes > 0;
+    }
+
+    return false;
+}
+
+bool Socket::IsClosed() const
+{
+    return m_closed;
+}
+
+bool Socket::IsLocal() const
+{
+    return m_family == AF_UNIX;
+}
+
+int Socket::GetHandle() const
+{
+    return m_socketHandle;
+}
+
+std::string Socket::GetHostname() const
+{
+    return m_hostname;
+}
+
+uint16_t Socket::GetPort() const
+{
+    return m_port;
+}
+
+uint64_t Socket::GetBytesSent() const
+{
+    return m_bytesSent;
+}
+
+uint64_t Socket::GetBytesReceived() const
+{
+    return m_bytesReceived;
+}
@@ -0,0 +1,139 @@
+/**
+ * Project: IPK - Projects 1 and 2 (2014) - shared networking library
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <queue>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "Resolver.h"
+
+#define INVALID_SOCKET          -1
+#define DEFAULT_BUFFER_SIZE     4096
+#define FAST_OPEN_QUEUE_SIZE    256
+#define MAX_RECV_DESCRIPTORS    4
+#define WRITE_PROGRESS_MIN_BYTES    65536
+
+// Stream socket shared by ftpclient, server and client. Network sockets are connected to every resolved address
+// in parallel, local (unix domain) ones can carry file descriptors along the data.
+class Socket
+{
+public:
+    Socket(const std::string& hostname, uint16_t port);
+    // local (unix domain) stream socket
+    explicit Socket(const std::string& path);
+    // already accepted connection
+    Socket(int socketFd, const sockaddr_storage* socketAddr, socklen_t socketAddrLen);
+    virtual ~Socket();
+
+    // Open() resolves the hostname itself if it wasn't done before, options set before Open() are applied by it
+    void Resolve();
+    void Open();
+    void Connect();
+    void Close();
+
+    // local socket is accessible to its owner only
+    void Bind();
+    void Listen();
+    // returns INVALID_SOCKET if no connection came in 'timeoutSec'
+    int AcceptHandle(uint32_t timeoutSec, sockaddr_storage& sessionAddress, socklen_t& sessionAddressLen);
+
+    // received data are kept in the ring buffer, view is the contiguous part of them starting at the oldest byte,
+    // the rest (if the data wrap around) is available by the next call after rewinding the view
+    uint32_t GetBufferView(const uint8_t*& data) const;
+    uint32_t GetBufferSize() const;
+    void RewindBuffer(uint32_t count);
+    // first read waits for the data (up to recv timeout), the following ones only take what has already arrived
+    void FillBuffer();
+
+    // unbuffered read, returns -1 with errno set like recv() does, descriptors coming over local socket are queued
+    int64_t RecvBytes(uint8_t* buffer, uint64_t bufferSize, int flags = 0);
+    // descriptors received over local socket in order of their arrival, caller becomes the owner
+    int GetReceivedDescriptor();
+
+    // with the write timeout set, the peer which stops keeping up has to accept WRITE_PROGRESS_MIN_BYTES until the deadline
+    // or it is considered stalled, the deadline goes on across the sends
+    void Send(const void* buffer, uint64_t bufferSize);
+    void SendVector(const iovec* parts, uint32_t partCount);
+    // sends the data together with the file descriptor, local sockets only
+    void SendDescriptor(const void* buffer, uint64_t bufferSize, int fd);
+
+    // applies to the connected socket, Connect() itself always waits for the result
+    void SetNonBlocking(bool nonBlocking);
+    void SetRecvTimeout(uint32_t timeoutSecs, uint32_t timeoutUsecs = 0);
+    void GetRecvTimeout(uint32_t& timeoutSecs, uint32_t& timeoutUsecs) const;
+    void SetSendLimits(uint32_t bufferSize, uint32_t timeoutMs);
+    void SetReusableAddress(bool reusable);
+    // more sockets can listen on the same port, the kernel spreads the incoming connections among them
+    void SetReusablePort(bool reusable);
+    void SetNoDelay(bool noDelay);
+    // server side of TCP Fast Open, must be called before Listen()
+    bool SetFastOpen(uint32_t queueSize);
+    // client side of TCP Fast Open, must be called before Connect(), the first Send() then goes with SYN, hostnames with
+    // more addresses race them with the plain connects though
+    bool SetFastOpenConnect(bool fastOpen);
+
+    bool IsReadyToRead(uint32_t timeoutSecs);
+    bool IsClosed() const;
+    bool IsLocal() const;
+
+    int GetHandle() const;
+    std::string GetHostname() const;
+    uint16_t GetPort() const;
+    uint64_t GetBytesSent() const;
+    uint64_t GetBytesReceived() const;
+
+private:
+    struct SocketOption
+    {
+        int level;
+        int name;
+        int value;
+    };
+
+    Socket(const Socket&);
+    Socket& operator =(const Socket&);
+
+    void Init();
+    // options are remembered, so they can be set on the socket created later and on the parallel connection attempts
+    bool SetOption(int level, int name, int value);
+    // connection attempts of the Happy Eyeballs race don't get the fast open connect
+    void ApplyOptions(int socketFd, bool connectAttempt = false) const;
+    int64_t RecvVector(iovec* parts, uint32_t partCount, int flags);
+    // sends as much as the socket takes at once, waits for it up to the write deadline
+    int64_t SendMessage(const msghdr& msg, const char* errorMessage);
+    void WaitWritable();
+
+    int m_socketHandle;
+    int m_family;
+    sockaddr_storage m_socketAddr;
+    socklen_t m_socketAddrLen;
+    std::string m_hostname;
+    uint16_t m_port;
+    AddressList m_remoteAddresses;
+    bool m_resolved;
+    std::vector<SocketOption> m_options;
+    timeval m_recvTimeout;
+    uint32_t m_writeTimeout;
+    bool m_writeStalled;
+    std::chrono::steady_clock::time_point m_writeDeadline;
+    uint64_t m_stalledBytesSent;
+    std::vector<uint8_t> m_buffer;
+    uint32_t m_bufferStart;
+    uint32_t m_bufferSize;
+    bool m_closed;
+    bool m_nonBlocking;
+    std::queue<int> m_recvFdQueue;
+    uint64_t m_bytesSent;
+    uint64_t m_bytesReceived;
+};
+
+#endif // SOCKET_H
@@ -0,0 +1,456 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <strings.h>
+#include <sstream>
+#include <algorithm>
+#include <zlib.h>
+#include "BenchServer.h"
+#include "IPKException.h"
+
+#define ACCEPT_POLL_INTERVAL    200
+#define DATA_ACCEPT_TIMEOUT     10000
+#define MAX_ENTRY_LENGTH        128
+
+// sends everything or fails, client may close the connection any time
+static bool sendAll(int fd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR)
+            continue;
+
+        if (sent <= 0)
+            return false;
+
+        data += sent;
+        length -= sent;
+    }
+
+    return true;
+}
+
+// Data connection in either stream mode or MODE Z.
+class DataStream
+{
+public:
+    DataStream(int fd, bool compressed) : m_fd(fd), m_compressed(compressed), m_bytesSent(0), m_outBuffer(BENCH_SEND_BUFFER_SIZE)
+    {
+        memset(&m_stream, 0, sizeof(z_stream));
+        if (m_compressed && deflateInit(&m_stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+            throw IPKException("DataStream::DataStream - unable to initialize compression");
+    }
+
+    ~DataStream()
+    {
+        if (m_compressed)
+            deflateEnd(&m_stream);
+    }
+
+    bool Write(const char* data, size_t length)
+    {
+        if (!m_compressed)
+        {
+            m_bytesSent += length;
+            return sendAll(m_fd, data, length);
+        }
+
+        return Deflate(data, length, Z_NO_FLUSH);
+    }
+
+    bool Finish()
+    {
+        return !m_compressed || Deflate(NULL, 0, Z_FINISH);
+    }
+
+    uint64_t GetBytesSent() const
+    {
+        return m_bytesSent;
+    }
+
+private:
+    bool Deflate(const char* data, size_t length, int flush)
+    {
+        m_stream.next_in = (Bytef*)data;
+        m_stream.avail_in = length;
+        do
+        {
+            m_stream.next_out = (Bytef*)m_outBuffer.data();
+            m_stream.avail_out = m_outBuffer.size();
+            deflate(&m_stream, flush);
+
+            uint32_t outputSize = m_outBuffer.size() - m_stream.avail_out;
+            m_bytesSent += outputSize;
+            if (outputSize && !sendAll(m_fd, m_outBuffer.data(), outputSize))
+                return false;
+        } while (m_stream.avail_out == 0);
+
+        return true;
+    }
+
+    int m_fd;
+    bool m_compressed;
+    uint64_t m_bytesSent;
+    z_stream m_stream;
+    std::vector<char> m_outBuffer;
+};
+
+BenchServer::BenchServer(uint16_t port, uint32_t rttMsecs) : m_listenFd(-1), m_port(port), m_rttMsecs(rttMsecs), m_stopped(false)
+{
+    m_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (m_listenFd == -1)
+        throw IPKException("BenchServer::BenchServer - unable to create socket");
+
+    int reuse = 1;
+    setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in localPoint;
+    socklen_t localPointLength = sizeof(sockaddr_in);
+    memset(&localPoint, 0, sizeof(sockaddr_in));
+    localPoint.sin_family = AF_INET;
+    localPoint.sin_port = htons(port);
+    localPoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(m_listenFd, (const sockaddr*)&localPoint, sizeof(sockaddr_in)) != 0 || listen(m_listenFd, SOMAXCONN) != 0
+        || getsockname(m_listenFd, (sockaddr*)&localPoint, &localPointLength) != 0)
+    {
+        close(m_listenFd);
+        throw IPKException("BenchServer::BenchServer - unable to listen on the port");
+    }
+
+    m_port = ntohs(localPoint.sin_port);
+}
+
+BenchServer::~BenchServer()
+{
+    Stop();
+    close(m_listenFd);
+}
+
+uint16_t BenchServer::GetPort() const
+{
+    return m_port;
+}
+
+void BenchServer::Start()
+{
+    m_acceptThread = std::thread(&BenchServer::AcceptLoop, this);
+}
+
+void BenchServer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+
+    if (m_acceptThread.joinable())
+        m_acceptThread.join();
+
+    // sessions end when their clients quit
+    for (std::thread& thread : m_sessionThreads)
+        thread.join();
+
+    m_sessionThreads.clear();
+}
+
+std::vector<SessionTiming> BenchServer::TakeTimings()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<SessionTiming> timings;
+    timings.swap(m_timings);
+    return timings;
+}
+
+void BenchServer::AcceptLoop()
+{
+    pollfd pollFd;
+    pollFd.fd = m_listenFd;
+    pollFd.events = POLLIN;
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stopped)
+                return;
+        }
+
+        pollFd.revents = 0;
+        if (poll(&pollFd, 1, ACCEPT_POLL_INTERVAL) <= 0)
+            continue;
+
+        int controlFd = accept4(m_listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (controlFd == -1)
+            continue;
+
+        // replies go out one by one, Nagle would hold each of them until the previous one is acknowledged
+        int noDelay = 1;
+        setsockopt(controlFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        m_sessionThreads.push_back(std::thread(&BenchServer::ProcessSession, this, controlFd));
+    }
+}
+
+void BenchServer::ProcessSession(int controlFd)
+{
+    SessionTiming timing;
+    timing.accepted = std::chrono::steady_clock::now();
+    timing.bytesSent = 0;
+
+    int passiveFd = -1;
+    uint64_t restOffset = 0;
+    bool compressed = false;
+    bool transferred = false;
+    std::string commands;
+    char recvBuffer[4096];
+    auto storeTiming = [&]()
+    {
+        if (!transferred)
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_timings.push_back(timing);
+        transferred = false;
+    };
+
+    // the connection handshake takes its round trip before the client can see the greeting
+    if (m_rttMsecs)
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_rttMsecs));
+
+    SendReply(controlFd, "220 ftpbench ready");
+    while (true)
+    {
+        size_t lineEnd = commands.find('\n');
+        if (lineEnd == std::string::npos)
+        {
+            ssize_t bytes = recv(controlFd, recvBuffer, sizeof(recvBuffer), 0);
+            if (bytes == -1 && errno == EINTR)
+                continue;
+
+            if (bytes <= 0)
+                break;
+
+            // every batch of commands travels there and its replies back, the commands sent together in one batch
+            // (pipelined) share the round trip
+            if (m_rttMsecs)
+                std::this_thread::sleep_for(std::chrono::milliseconds(m_rttMsecs));
+
+            commands.append(recvBuffer, bytes);
+            continue;
+        }
+
+        std::string line = commands.substr(0, lineEnd);
+        commands.erase(0, lineEnd + 1);
+        if (!line.empty() && line[line.length() - 1] == '\r')
+            line.erase(line.length() - 1);
+
+        size_t space = line.find(' ');
+        std::string command = line.substr(0, space);
+        std::string arg = (space == std::string::npos) ? "" : line.substr(space + 1);
+        std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+        uint64_t number = 0;
+        if (command == "USER")
+            SendReply(controlFd, "331 Password required");
+        else if (command == "PASS")
+        {
+            SendReply(controlFd, "230 Logged in");
+            timing.loggedIn = std::chrono::steady_clock::now();
+        }
+        else if (command == "TYPE" || command == "NOOP")
+            SendReply(controlFd, "200 OK");
+        else if (command == "FEAT")
+            SendReply(controlFd, "211-Features:\r\n MODE Z\r\n REST STREAM\r\n SIZE\r\n MDTM\r\n211 End");
+        else if (command == "MODE" && (strcasecmp(arg.c_str(), "Z") == 0 || strcasecmp(arg.c_str(), "S") == 0))
+        {
+            compressed = (strcasecmp(arg.c_str(), "Z") == 0);
+            SendReply(controlFd, "200 Mode set");
+        }
+        else if (command == "PASV")
+        {
+            if (passiveFd != -1)
+                close(passiveFd);
+
+            sockaddr_in localPoint;
+            socklen_t localPointLength = sizeof(sockaddr_in);
+            memset(&localPoint, 0, sizeof(sockaddr_in));
+            localPoint.sin_family = AF_INET;
+            localPoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            passiveFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+            if (passiveFd == -1 || bind(passiveFd, (const sockaddr*)&localPoint, sizeof(sockaddr_in)) != 0
+                || listen(passiveFd, 1) != 0 || getsockname(passiveFd, (sockaddr*)&localPoint, &localPointLength) != 0)
+            {
+                SendReply(controlFd, "425 Can't open passive connection");
+                continue;
+            }
+
+            uint16_t port = ntohs(localPoint.sin_port);
+            std::ostringstream reply;
+            reply << "227 Entering Passive Mode (127,0,0,1," << (port >> 8) << ',' << (port & 0xFF) << ")";
+            SendReply(controlFd, reply.str());
+            timing.passiveMode = std::chrono::steady_clock::now();
+        }
+        else if (command == "SIZE" && ParseSyntheticPath(arg, "/file/", number))
+        {
+            std::ostringstream reply;
+            reply << "213 " << number;
+            SendReply(controlFd, reply.str());
+        }
+        else if (command == "MDTM")
+            SendReply(controlFd, "213 20140101000000");
+        else if (command == "REST")
+        {
+            restOffset = strtoull(arg.c_str(), NULL, 10);
+            SendReply(controlFd, "350 Restarting");
+        }
+        else if ((command == "LIST" || command == "MLSD") && !ParseSyntheticPath(arg, "/list/", number))
+            SendReply(controlFd, "550 No such directory");
+        else if (command == "RETR" && !ParseSyntheticPath(arg, "/file/", number))
+            SendReply(controlFd, "550 No such file");
+        else if (command == "LIST" || command == "MLSD" || command == "RETR")
+        {
+            if (passiveFd == -1)
+            {
+                SendReply(controlFd, "425 Use PASV first");
+                continue;
+            }
+
+            SendReply(controlFd, "150 Opening data connection");
+
+            pollfd pollFd;
+            pollFd.fd = passiveFd;
+            pollFd.events = POLLIN;
+            pollFd.revents = 0;
+            int dataFd = (poll(&pollFd, 1, DATA_ACCEPT_TIMEOUT) == 1) ? accept4(passiveFd, NULL, NULL, SOCK_CLOEXEC) : -1;
+            close(passiveFd);
+            passiveFd = -1;
+            if (dataFd == -1)
+            {
+                SendReply(controlFd, "425 Can't open data connection");
+                continue;
+            }
+
+            timing.dataAccepted = std::chrono::steady_clock::now();
+
+            // the data connection handshake takes its round trip too
+            if (m_rttMsecs)
+                std::this_thread::sleep_for(std::chrono::milliseconds(m_rttMsecs));
+
+            bool complete;
+            try
+            {
+                DataStream dataStream(dataFd, compressed);
+                if (command == "RETR")
+                    SendFile(dataStream, number, restOffset);
+                else
+                    SendListing(dataStream, number, command == "MLSD");
+
+                complete = dataStream.Finish();
+                timing.bytesSent = dataStream.GetBytesSent();
+            }
+            catch (const IPKException&)
+            {
+                complete = false;
+            }
+
+            close(dataFd);
+            timing.transferDone = std::chrono::steady_clock::now();
+            transferred = true;
+            restOffset = 0;
+            SendReply(controlFd, complete ? "226 Transfer complete" : "426 Transfer aborted");
+        }
+        else if (command == "QUIT")
+        {
+            // the benchmark takes the timing as soon as the client exits, which may be right after this reply
+            storeTiming();
+            SendReply(controlFd, "221 Goodbye");
+            break;
+        }
+        else
+            SendReply(controlFd, "502 Command not implemented");
+    }
+
+    if (passiveFd != -1)
+        close(passiveFd);
+
+    close(controlFd);
+    storeTiming();
+}
+
+void BenchServer::SendReply(int controlFd, const std::string& reply)
+{
+    std::string line = reply + "\r\n";
+    sendAll(controlFd, line.c_str(), line.length());
+}
+
+void BenchServer::SendListing(DataStream& dataStream, uint64_t entryCount, bool mlsd)
+{
+    // entries are generated right into the send buffer, the listing of any size costs no memory
+    std::vector<char> buffer(BENCH_SEND_BUFFER_SIZE);
+    uint32_t used = 0;
+    for (uint64_t i = 0; i < entryCount; ++i)
+    {
+        unsigned long long size = (i * 7919) % 1000000;
+        if (mlsd)
+            used += snprintf(buffer.data() + used, MAX_ENTRY_LENGTH, "type=file;size=%llu;modify=20140101000000; file%08llu\r\n", size,
+                (unsigned long long)i);
+        else
+            used += snprintf(buffer.data() + used, MAX_ENTRY_LENGTH, "-rw-r--r--   1 ftp      ftp      %10llu Jan 01  2014 file%08llu\r\n",
+                size, (unsigned long long)i);
+
+        if (used + MAX_ENTRY_LENGTH > buffer.size())
+        {
+            if (!dataStream.Write(buffer.data(), used))
+                throw IPKException("BenchServer::SendListing - client closed the data connection");
+
+            used = 0;
+        }
+    }
+
+    if (used && !dataStream.Write(buffer.data(), used))
+        throw IPKException("BenchServer::SendListing - client closed the data connection");
+}
+
+void BenchServer::SendFile(DataStream& dataStream, uint64_t fileSize, uint64_t offset)
+{
+    // content depends only on the position in the file, so the resumed and segmented downloads can be checked
+    std::vector<char> buffer(BENCH_SEND_BUFFER_SIZE);
+    while (offset < fileSize)
+    {
+        uint32_t chunkSize = std::min<uint64_t>(buffer.size(), fileSize - offset);
+        for (uint32_t i = 0; i < chunkSize; ++i)
+            buffer[i] = 'a' + (offset + i) % 26;
+
+        if (!dataStream.Write(buffer.data(), chunkSize))
+            throw IPKException("BenchServer::SendFile - client closed the data connection");
+
+        offset += chunkSize;
+    }
+}
+
+bool BenchServer::ParseSyntheticPath(const std::string& path, const char* prefix, uint64_t& number)
+{
+    // leading slash is optional, client sends the path the way it got it
+    const char* pathStr = path.c_str();
+    const char* prefixStr = (pathStr[0] == '/') ? prefix : prefix + 1;
+    size_t prefixLength = strlen(prefixStr);
+    if (strncmp(pathStr, prefixStr, prefixLength) != 0 || !isdigit(pathStr[prefixLength]))
+        return false;
+
+    char* numberEnd;
+    number = strtoull(pathStr + prefixLength, &numberEnd, 10);
+    return *numberEnd == '\0' || (*numberEnd == '/' && numberEnd[1] == '\0');
+}
@@ -0,0 +1,70 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef BENCH_SERVER_H
+#define BENCH_SERVER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+
+#define BENCH_SEND_BUFFER_SIZE  65536
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+class DataStream;
+
+// moments of one control connection as the server saw them
+struct SessionTiming
+{
+    TimePoint accepted;
+    TimePoint loggedIn;
+    TimePoint passiveMode;
+    TimePoint dataAccepted;
+    TimePoint transferDone;
+    uint64_t bytesSent;
+};
+
+// Stand-in FTP server with the made-up content, so ftpclient can be measured without the real one. Path /list/N is
+// a directory of N files, /file/N is a file of N bytes. Every batch of received commands is delayed by the artificial
+// round trip time, so the commands sent together pay it only once.
+class BenchServer
+{
+public:
+    BenchServer(uint16_t port = 0, uint32_t rttMsecs = 0);
+    ~BenchServer();
+
+    uint16_t GetPort() const;
+
+    void Start();
+    void Stop();
+    // timings of the sessions finished since the last call
+    std::vector<SessionTiming> TakeTimings();
+
+private:
+    BenchServer(const BenchServer&);
+    BenchServer& operator=(const BenchServer&);
+
+    void AcceptLoop();
+    void ProcessSession(int controlFd);
+    void SendReply(int controlFd, const std::string& reply);
+    void SendListing(DataStream& dataStream, uint64_t entryCount, bool mlsd);
+    void SendFile(DataStream& dataStream, uint64_t fileSize, uint64_t offset);
+
+    static bool ParseSyntheticPath(const std::string& path, const char* prefix, uint64_t& number);
+
+    int m_listenFd;
+    uint16_t m_port;
+    uint32_t m_rttMsecs;
+    bool m_stopped;
+    std::thread m_acceptThread;
+    std::vector<std::thread> m_sessionThreads;
+    std::vector<SessionTiming> m_timings;
+    std::mutex m_mutex;
+};
+
+#endif // BENCH_SERVER_H
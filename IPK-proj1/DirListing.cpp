@@ -0,0 +1,373 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <cstring>
+#include <ctime>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "DirListing.h"
+
+#define MAX_MLSD_FACTS      16
+#define SECONDS_PER_DAY     86400
+
+static const char* EntryTypeNames[] = { "file", "dir", "link", "other" };
+static const char* MonthNames = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+uint32_t ScanFields(const char* line, uint32_t length, char delim, uint32_t* fieldStarts, uint32_t maxFields)
+{
+    uint32_t fieldCount = 0;
+    uint32_t pos = 0;
+    bool prevDelim = true; // beginning of the line behaves like delimiter
+
+#ifdef __SSE2__
+    // compare 16 bytes at once, field starts where the delimiter is followed by anything else
+    const __m128i delimVec = _mm_set1_epi8(delim);
+    while (pos + 16 <= length && fieldCount < maxFields)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)(line + pos));
+        uint32_t delimMask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, delimVec));
+        uint32_t startMask = ~delimMask & ((delimMask << 1) | (prevDelim ? 1 : 0)) & 0xFFFF;
+
+        while (startMask && fieldCount < maxFields)
+        {
+            fieldStarts[fieldCount++] = pos + __builtin_ctz(startMask);
+            startMask &= startMask - 1;
+        }
+
+        prevDelim = (delimMask & 0x8000) != 0;
+        pos += 16;
+    }
+#endif
+
+    // the rest of the line shorter than one block
+    for (; pos < length && fieldCount < maxFields; ++pos)
+    {
+        bool isDelim = (line[pos] == delim);
+        if (!isDelim && prevDelim)
+            fieldStarts[fieldCount++] = pos;
+
+        prevDelim = isDelim;
+    }
+
+    return fieldCount;
+}
+
+static uint32_t FieldLength(const char* field, const char* lineEnd, char delim)
+{
+    const char* fieldEnd = (const char*)memchr(field, delim, lineEnd - field);
+    return (fieldEnd ? fieldEnd : lineEnd) - field;
+}
+
+static bool ParseNumber(const char* str, uint32_t length, uint64_t& number, uint32_t base = 10)
+{
+    if (!length)
+        return false;
+
+    number = 0;
+    for (uint32_t i = 0; i < length; ++i)
+    {
+        uint32_t digit = str[i] - '0';
+        if (digit >= base)
+            return false;
+
+        number = number * base + digit;
+    }
+
+    return true;
+}
+
+static uint32_t StripLineEnd(const char* line, uint32_t length)
+{
+    while (length && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        length--;
+
+    return length;
+}
+
+static void WriteEscaped(FILE* output, const char* str, uint32_t length, bool escapeJson)
+{
+    for (uint32_t i = 0; i < length; ++i)
+    {
+        unsigned char c = str[i];
+        if (c == '\\' || (escapeJson && c == '"'))
+        {
+            fputc('\\', output);
+            fputc(c, output);
+        }
+        else if (c == '\t')
+            fputs("\\t", output);
+        else if (c == '\n')
+            fputs("\\n", output);
+        else if (escapeJson && c < 0x20)
+            fprintf(output, "\\u%04x", c);
+        else
+            fputc(c, output);
+    }
+}
+
+DirListing::DirListing()
+{
+    m_now = time(NULL);
+
+    tm nowTm;
+    gmtime_r(&m_now, &nowTm);
+    m_currentYear = nowTm.tm_year;
+}
+
+bool DirListing::ParseListLine(const char* line, uint32_t length)
+{
+    length = StripLineEnd(line, length);
+    const char* lineEnd = line + length;
+
+    // <perms> <links> <owner> [<group>] <size> <month> <day> <time or year> <name>
+    uint32_t fields[MAX_LIST_FIELDS];
+    uint32_t fieldCount = ScanFields(line, length, ' ', fields, MAX_LIST_FIELDS);
+    if (fieldCount < MAX_LIST_FIELDS - 1 || FieldLength(line, lineEnd, ' ') != 10)
+        return false;
+
+    DirEntryType type;
+    switch (line[0])
+    {
+        case '-': type = DIR_ENTRY_FILE; break;
+        case 'd': type = DIR_ENTRY_DIR; break;
+        case 'l': type = DIR_ENTRY_LINK; break;
+        case 'b': case 'c': case 'p': case 's': type = DIR_ENTRY_OTHER; break;
+        default: return false;
+    }
+
+    uint16_t perms = 0;
+    for (uint32_t i = 0; i < 9; ++i)
+    {
+        char perm = line[i + 1];
+        if (perm != '-' && perm != 'S' && perm != 'T')
+            perms |= 1 << (8 - i);
+    }
+
+    // some servers don't show the group
+    uint64_t size;
+    uint32_t sizeField = 4;
+    if (fieldCount < MAX_LIST_FIELDS || !ParseNumber(line + fields[4], FieldLength(line + fields[4], lineEnd, ' '), size))
+    {
+        sizeField = 3;
+        if (!ParseNumber(line + fields[3], FieldLength(line + fields[3], lineEnd, ' '), size))
+            return false;
+    }
+
+    const char* monthName = line + fields[sizeField + 1];
+    int32_t month = -1;
+    for (int32_t i = 0; i < 12 && FieldLength(monthName, lineEnd, ' ') == 3; ++i)
+    {
+        if (memcmp(monthName, MonthNames + i * 3, 3) == 0)
+        {
+            month = i;
+            break;
+        }
+    }
+
+    uint64_t day, hours = 0, minutes = 0, year;
+    const char* timeOrYear = line + fields[sizeField + 3];
+    uint32_t timeOrYearLength = FieldLength(timeOrYear, lineEnd, ' ');
+    if (month == -1 || !ParseNumber(line + fields[sizeField + 2], FieldLength(line + fields[sizeField + 2], lineEnd, ' '), day))
+        return false;
+
+    bool hasYear = (timeOrYearLength != 5 || timeOrYear[2] != ':');
+    if (hasYear && !ParseNumber(timeOrYear, timeOrYearLength, year))
+        return false;
+    else if (!hasYear && (!ParseNumber(timeOrYear, 2, hours) || !ParseNumber(timeOrYear + 3, 2, minutes)))
+        return false;
+
+    tm modifyTm;
+    memset(&modifyTm, 0, sizeof(tm));
+    modifyTm.tm_year = hasYear ? year - 1900 : m_currentYear;
+    modifyTm.tm_mon = month;
+    modifyTm.tm_mday = day;
+    modifyTm.tm_hour = hours;
+    modifyTm.tm_min = minutes;
+    int64_t modifyTime = timegm(&modifyTm);
+
+    // entries without the year are from the last 6 months, so the time in the future means the last year
+    if (!hasYear && modifyTime > m_now + SECONDS_PER_DAY)
+    {
+        modifyTm.tm_year--;
+        modifyTime = timegm(&modifyTm);
+    }
+
+    const char* name = line + fields[sizeField + 4];
+    uint32_t nameLength = lineEnd - name;
+    if (type == DIR_ENTRY_LINK)
+    {
+        const char* target = (const char*)memmem(name, nameLength, " -> ", 4);
+        if (target)
+            nameLength = target - name;
+    }
+
+    if ((nameLength == 1 && name[0] == '.') || (nameLength == 2 && name[0] == '.' && name[1] == '.'))
+        return false;
+
+    AddEntry(name, nameLength, type, size, modifyTime, perms);
+    return true;
+}
+
+bool DirListing::ParseMlsdLine(const char* line, uint32_t length)
+{
+    length = StripLineEnd(line, length);
+
+    // <fact>=<value>;<fact>=<value>; <name>
+    const char* factsEnd = (const char*)memchr(line, ' ', length);
+    if (!factsEnd)
+        return false;
+
+    uint32_t facts[MAX_MLSD_FACTS];
+    uint32_t factCount = ScanFields(line, factsEnd - line, ';', facts, MAX_MLSD_FACTS);
+
+    DirEntryType type = DIR_ENTRY_OTHER;
+    uint64_t size = 0, perms = 0;
+    int64_t modifyTime = 0;
+    for (uint32_t i = 0; i < factCount; ++i)
+    {
+        const char* fact = line + facts[i];
+        uint32_t factLength = FieldLength(fact, factsEnd, ';');
+        const char* value = (const char*)memchr(fact, '=', factLength);
+        if (!value)
+            continue;
+
+        uint32_t keyLength = value - fact;
+        uint32_t valueLength = factLength - keyLength - 1;
+        value++;
+
+        if (keyLength == 4 && strncasecmp(fact, "type", 4) == 0)
+        {
+            if (valueLength == 4 && strncasecmp(value, "file", 4) == 0)
+                type = DIR_ENTRY_FILE;
+            else if (valueLength == 3 && strncasecmp(value, "dir", 3) == 0)
+                type = DIR_ENTRY_DIR;
+            else if ((valueLength == 4 && strncasecmp(value, "cdir", 4) == 0) || (valueLength == 4 && strncasecmp(value, "pdir", 4) == 0))
+                return false;
+            else if (valueLength > 8 && strncasecmp(value, "OS.unix=", 8) == 0 && (value[8] == 's' || value[8] == 'S'))
+                type = DIR_ENTRY_LINK;
+        }
+        else if ((keyLength == 4 && strncasecmp(fact, "size", 4) == 0) || (keyLength == 4 && strncasecmp(fact, "sizd", 4) == 0))
+            ParseNumber(value, valueLength, size);
+        else if (keyLength == 6 && strncasecmp(fact, "modify", 6) == 0 && valueLength >= 14)
+        {
+            uint64_t year, month, day, hours, minutes, seconds;
+            if (ParseNumber(value, 4, year) && ParseNumber(value + 4, 2, month) && ParseNumber(value + 6, 2, day)
+                && ParseNumber(value + 8, 2, hours) && ParseNumber(value + 10, 2, minutes) && ParseNumber(value + 12, 2, seconds))
+            {
+                tm modifyTm;
+                memset(&modifyTm, 0, sizeof(tm));
+                modifyTm.tm_year = year - 1900;
+                modifyTm.tm_mon = month - 1;
+                modifyTm.tm_mday = day;
+                modifyTm.tm_hour = hours;
+                modifyTm.tm_min = minutes;
+                modifyTm.tm_sec = seconds;
+                modifyTime = timegm(&modifyTm);
+            }
+        }
+        else if (keyLength == 9 && strncasecmp(fact, "UNIX.mode", 9) == 0)
+            ParseNumber(value, valueLength, perms, 8);
+    }
+
+    const char* name = factsEnd + 1;
+    uint32_t nameLength = line + length - name;
+    if (!nameLength)
+        return false;
+
+    AddEntry(name, nameLength, type, size, modifyTime, perms & 07777);
+    return true;
+}
+
+uint32_t DirListing::GetEntryCount() const
+{
+    return m_types.size();
+}
+
+DirEntryType DirListing::GetType(uint32_t index) const
+{
+    return (DirEntryType)m_types[index];
+}
+
+std::string DirListing::GetName(uint32_t index) const
+{
+    uint32_t nameStart = m_nameOffsets[index];
+    uint32_t nameEnd = (index + 1 < m_nameOffsets.size()) ? m_nameOffsets[index + 1] : m_names.length();
+    return m_names.substr(nameStart, nameEnd - nameStart);
+}
+
+void DirListing::SetNamePrefix(const std::string& namePrefix)
+{
+    m_namePrefix = namePrefix;
+}
+
+void DirListing::Clear()
+{
+    // keep the capacity for the next batch
+    m_nameOffsets.clear();
+    m_names.clear();
+    m_types.clear();
+    m_sizes.clear();
+    m_modifyTimes.clear();
+    m_perms.clear();
+}
+
+void DirListing::AddEntry(const char* name, uint32_t nameLength, DirEntryType type, uint64_t size, int64_t modifyTime, uint16_t perms)
+{
+    m_nameOffsets.push_back(m_names.length());
+    m_names.append(name, nameLength);
+    m_types.push_back(type);
+    m_sizes.push_back(size);
+    m_modifyTimes.push_back(modifyTime);
+    m_perms.push_back(perms);
+}
+
+void DirListing::WriteName(FILE* output, uint32_t index, bool escapeJson) const
+{
+    uint32_t nameStart = m_nameOffsets[index];
+    uint32_t nameEnd = (index + 1 < m_nameOffsets.size()) ? m_nameOffsets[index + 1] : m_names.length();
+
+    WriteEscaped(output, m_namePrefix.c_str(), m_namePrefix.length(), escapeJson);
+    WriteEscaped(output, m_names.c_str() + nameStart, nameEnd - nameStart, escapeJson);
+}
+
+void DirListing::WriteNames(FILE* output) const
+{
+    for (uint32_t i = 0; i < GetEntryCount(); ++i)
+    {
+        WriteName(output, i, false);
+        fputc('\n', output);
+    }
+}
+
+void DirListing::WriteTsv(FILE* output) const
+{
+    for (uint32_t i = 0; i < GetEntryCount(); ++i)
+    {
+        char modifyTimeStr[32];
+        time_t modifyTime = m_modifyTimes[i];
+        tm modifyTm;
+        strftime(modifyTimeStr, sizeof(modifyTimeStr), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&modifyTime, &modifyTm));
+
+        WriteName(output, i, false);
+        fprintf(output, "\t%s\t%llu\t%s\t%04o\n", EntryTypeNames[m_types[i]], (unsigned long long)m_sizes[i], modifyTimeStr, m_perms[i]);
+    }
+}
+
+void DirListing::WriteJson(FILE* output, bool firstBatch) const
+{
+    for (uint32_t i = 0; i < GetEntryCount(); ++i)
+    {
+        char modifyTimeStr[32];
+        time_t modifyTime = m_modifyTimes[i];
+        tm modifyTm;
+        strftime(modifyTimeStr, sizeof(modifyTimeStr), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&modifyTime, &modifyTm));
+
+        fputs((firstBatch && i == 0) ? "\n  {\"name\": \"" : ",\n  {\"name\": \"", output);
+        WriteName(output, i, true);
+        fprintf(output, "\", \"type\": \"%s\", \"size\": %llu, \"mtime\": \"%s\", \"perms\": \"%04o\"}", EntryTypeNames[m_types[i]],
+            (unsigned long long)m_sizes[i], modifyTimeStr, m_perms[i]);
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#define MAX_LIST_FIELDS     9
+
+enum DirEntryType
+{
+    DIR_ENTRY_FILE              = 0,
+    DIR_ENTRY_DIR,
+    DIR_ENTRY_LINK,
+    DIR_ENTRY_OTHER
+};
+
+enum ListFormat
+{
+    LIST_FORMAT_RAW             = 0,
+    LIST_FORMAT_TSV,
+    LIST_FORMAT_JSON
+};
+
+// finds the starts of the first 'maxFields' fields separated by runs of 'delim', returns their count
+uint32_t ScanFields(const char* line, uint32_t length, char delim, uint32_t* fieldStarts, uint32_t maxFields);
+
+// Parsed directory entries stored by columns. Names are kept one after another in a single buffer, so adding
+// an entry doesn't allocate anything once the table has grown to its working size.
+class DirListing
+{
+public:
+    DirListing();
+
+    // both return false if the line is not a directory entry (header, '.' and '..' entries, garbage)
+    bool ParseListLine(const char* line, uint32_t length);
+    bool ParseMlsdLine(const char* line, uint32_t length);
+
+    uint32_t GetEntryCount() const;
+    DirEntryType GetType(uint32_t index) const;
+    std::string GetName(uint32_t index) const;
+    void Clear();
+
+    // prefix (usually the path of listed directory) written in front of every name
+    void SetNamePrefix(const std::string& namePrefix);
+
+    void WriteNames(FILE* output) const;
+    void WriteTsv(FILE* output) const;
+    // entries are written as the elements of the JSON array, the caller writes the brackets
+    void WriteJson(FILE* output, bool firstBatch) const;
+
+private:
+    void AddEntry(const char* name, uint32_t nameLength, DirEntryType type, uint64_t size, int64_t modifyTime, uint16_t perms);
+    void WriteName(FILE* output, uint32_t index, bool escapeJson) const;
+
+    std::vector<uint32_t> m_nameOffsets;
+    std::string m_names;
+    std::vector<uint8_t> m_types;
+    std::vector<uint64_t> m_sizes;
+    std::vector<int64_t> m_modifyTimes;
+    std::vector<uint16_t> m_perms;
+    std::string m_namePrefix;
+    time_t m_now;
+    int32_t m_currentYear;
+};
+
+#endif // DIR_LISTING_H
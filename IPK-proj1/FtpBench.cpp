@@ -0,0 +1,169 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "BenchServer.h"
+#include "IPKException.h"
+
+#define DEFAULT_MIN_ENTRIES     10
+#define DEFAULT_MAX_ENTRIES     10000000
+
+void printHelpClause(const char* left, const char* right)
+{
+    std::cout << std::setw(10) << std::setfill(' ') << left;
+    std::cout << std::setw(15 + strlen(right)) << std::setfill(' ') << right << std::endl;
+}
+
+void printHelp()
+{
+    std::cout << "IPK - Project 1 (2014) - FTP client benchmark" << std::endl;
+    std::cout << "Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Usage:" << std::endl;
+
+    const char* usage = "ftpbench --help | [--rtt MS] [--port PORT] (--serve | [--min N] [--max N] CLIENT [CLIENT_OPTIONS])";
+    std::cout << std::setw(10 + strlen(usage)) << std::setfill(' ') << usage << std::endl;
+    std::cout << std::endl;
+    printHelpClause("--help", "Prints help");
+    printHelpClause("--rtt", "Delays every batch of commands the server receives by MS milliseconds");
+    printHelpClause("--port", "Port of the server, any free one by default");
+    printHelpClause("--serve", "Only runs the server, /list/N is a directory of N files and /file/N is a file of N bytes");
+    printHelpClause("--min", "Smallest listing measured, the size grows ten times up to the largest one");
+    printHelpClause("--max", "Largest listing measured");
+    printHelpClause("CLIENT", "Path to ftpclient, CLIENT_OPTIONS are passed to it in front of the URL");
+}
+
+double msecsBetween(const TimePoint& from, const TimePoint& to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// runs the client with its output thrown away, returns false if it failed
+bool runClient(const std::vector<std::string>& args, rusage& usage)
+{
+    std::vector<char*> argv;
+    for (const std::string& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == -1)
+        throw IPKException("Unable to start the client");
+
+    if (pid == 0)
+    {
+        int nullFd = open("/dev/null", O_WRONLY);
+        dup2(nullFd, STDOUT_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status;
+    if (wait4(pid, &status, 0, &usage) != pid)
+        throw IPKException("Unable to wait for the client");
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        uint32_t rttMsecs = 0;
+        uint16_t port = 0;
+        bool serve = false;
+        uint64_t minEntries = DEFAULT_MIN_ENTRIES;
+        uint64_t maxEntries = DEFAULT_MAX_ENTRIES;
+        int clientArg = argc;
+        for (int i = 1; i < argc && clientArg == argc; ++i)
+        {
+            std::istringstream iss(i + 1 < argc ? argv[i + 1] : "");
+            if (strcmp(argv[i], "--help") == 0)
+            {
+                printHelp();
+                return 0;
+            }
+            else if (strcmp(argv[i], "--rtt") == 0 && (iss >> rttMsecs))
+                ++i;
+            else if (strcmp(argv[i], "--port") == 0 && (iss >> port))
+                ++i;
+            else if (strcmp(argv[i], "--min") == 0 && (iss >> minEntries) && minEntries)
+                ++i;
+            else if (strcmp(argv[i], "--max") == 0 && (iss >> maxEntries))
+                ++i;
+            else if (strcmp(argv[i], "--serve") == 0)
+                serve = true;
+            else if (strncmp(argv[i], "--", 2) != 0)
+                clientArg = i;
+            else
+                throw IPKException("Invalid parameters");
+        }
+
+        if (serve == (clientArg < argc))
+            throw IPKException("Invalid parameters");
+
+        BenchServer server(port, rttMsecs);
+        server.Start();
+        if (serve)
+        {
+            std::cout << "Listening on 127.0.0.1:" << server.GetPort() << std::endl;
+            pause();
+            return 0;
+        }
+
+        // times are seen from the server, except the connect which counts from the start of the client
+        printf("%10s %10s %10s %10s %10s %12s %12s %14s %12s\n", "entries", "connect", "login", "pasv", "dataconn", "transfer",
+            "total", "wire bytes", "peak rss");
+        fflush(stdout);
+        for (uint64_t entries = minEntries; entries <= maxEntries; entries *= 10)
+        {
+            std::ostringstream url;
+            url << "ftp://127.0.0.1:" << server.GetPort() << "/list/" << entries;
+
+            std::vector<std::string> args(argv + clientArg, argv + argc);
+            args.push_back(url.str());
+
+            rusage usage;
+            TimePoint started = std::chrono::steady_clock::now();
+            bool success = runClient(args, usage);
+            TimePoint finished = std::chrono::steady_clock::now();
+
+            std::vector<SessionTiming> timings = server.TakeTimings();
+            if (!success || timings.empty())
+            {
+                printf("%10llu %10s\n", (unsigned long long)entries, "failed");
+                fflush(stdout);
+                continue;
+            }
+
+            const SessionTiming& timing = timings.front();
+            printf("%10llu %8.2fms %8.2fms %8.2fms %8.2fms %10.2fms %10.2fms %14llu %10ldKB\n", (unsigned long long)entries,
+                msecsBetween(started, timing.accepted), msecsBetween(timing.accepted, timing.loggedIn),
+                msecsBetween(timing.loggedIn, timing.passiveMode), msecsBetween(timing.passiveMode, timing.dataAccepted),
+                msecsBetween(timing.dataAccepted, timing.transferDone), msecsBetween(started, finished),
+                (unsigned long long)timing.bytesSent, usage.ru_maxrss);
+            fflush(stdout);
+        }
+
+        server.Stop();
+    }
+    catch (const IPKException& ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <thread>
+#include "FtpCrawler.h"
+#include "IPKException.h"
+
+FtpCrawler::FtpCrawler(const char* hostname, uint16_t port, const char* username, const char* password) : m_hostname(hostname),
+    m_port(port), m_username(username ? username : ""), m_password(password ? password : ""), m_anonymous(!username),
+    m_sessionCount(1), m_maxDepth(UNLIMITED_DEPTH), m_listCommand(FTP_CMD_LIST), m_pipelining(false), m_compression(false),
+    m_trace(NULL), m_cache(NULL), m_cacheTtl(0), m_busyWorkers(0), m_listedDirs(0)
+{
+}
+
+void FtpCrawler::SetSessionCount(uint32_t sessionCount)
+{
+    if (sessionCount == 0 || sessionCount > MAX_CRAWL_SESSIONS)
+        throw IPKException("FtpCrawler::SetSessionCount - invalid number of sessions");
+
+    m_sessionCount = sessionCount;
+}
+
+void FtpCrawler::SetMaxDepth(uint32_t maxDepth)
+{
+    m_maxDepth = maxDepth;
+}
+
+void FtpCrawler::SetListCommand(FtpCommand listCommand)
+{
+    m_listCommand = listCommand;
+}
+
+void FtpCrawler::SetPipelining(bool pipelining)
+{
+    m_pipelining = pipelining;
+}
+
+void FtpCrawler::SetCompression(bool compression)
+{
+    m_compression = compression;
+}
+
+void FtpCrawler::SetTrace(SessionTrace* trace)
+{
+    m_trace = trace;
+}
+
+void FtpCrawler::SetCache(const ListingCache* cache, uint32_t cacheTtl)
+{
+    m_cache = cache;
+    m_cacheTtl = cacheTtl;
+}
+
+uint32_t FtpCrawler::Crawl(const char* rootPath, const CrawlDirCallback& dirCallback)
+{
+    std::string root = rootPath;
+    while (root.length() > 1 && root[root.length() - 1] == '/')
+        root.erase(root.length() - 1);
+
+    PendingDir rootDir;
+    rootDir.path = root;
+    rootDir.depth = 0;
+
+    m_pendingDirs.clear();
+    m_pendingDirs.push_back(rootDir);
+    m_visitedDirs.clear();
+    m_visitedDirs.insert(root);
+    m_failedDirs.clear();
+    m_busyWorkers = 0;
+    m_listedDirs = 0;
+    m_error = std::exception_ptr();
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < m_sessionCount; ++i)
+        workers.push_back(std::thread(&FtpCrawler::WorkerLoop, this, std::cref(dirCallback)));
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    // all the workers could have failed to log in before the whole tree was listed
+    for (PendingDir& dir : m_pendingDirs)
+        m_failedDirs.push_back(dir.path);
+
+    m_pendingDirs.clear();
+
+    // some sessions may fail to log in, that is fine as long as the others have done the work
+    if (m_error && !m_listedDirs)
+        std::rethrow_exception(m_error);
+
+    return m_listedDirs;
+}
+
+const std::vector<std::string>& FtpCrawler::GetFailedDirs() const
+{
+    return m_failedDirs;
+}
+
+std::string FtpCrawler::JoinPath(const std::string& dirPath, const std::string& name)
+{
+    if (dirPath.empty())
+        return name;
+
+    return (dirPath[dirPath.length() - 1] == '/') ? dirPath + name : dirPath + '/' + name;
+}
+
+FtpSession* FtpCrawler::CreateSession()
+{
+    FtpSession* session = new FtpSession(m_hostname.c_str(), m_port);
+    try
+    {
+        session->SetPipelining(m_pipelining);
+        session->SetCompression(m_compression);
+        session->SetTrace(m_trace);
+        session->Connect(m_anonymous ? NULL : m_username.c_str(), m_anonymous ? NULL : m_password.c_str());
+    }
+    catch (const IPKException&)
+    {
+        delete session;
+        throw;
+    }
+
+    return session;
+}
+
+void FtpCrawler::WorkerLoop(const CrawlDirCallback& dirCallback)
+{
+    // session is created only once the server has to be asked, cached directories don't need any
+    FtpSession* session = NULL;
+    bool loginFailed = false;
+    auto getSession = [&]()
+    {
+        if (!session)
+        {
+            try
+            {
+                session = CreateSession();
+            }
+            catch (const IPKException&)
+            {
+                loginFailed = true;
+                throw;
+            }
+        }
+
+        return session;
+    };
+
+    DirListing listing;
+    auto parseLine = [&](const char* line, uint32_t length)
+    {
+        if (m_listCommand == FTP_CMD_MLSD)
+            listing.ParseMlsdLine(line, length);
+        else
+            listing.ParseListLine(line, length);
+    };
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        // crawl is over once the queue is empty and nobody is listing the directory which could fill it again
+        m_workCondition.wait(lock, [this]() { return !m_pendingDirs.empty() || !m_busyWorkers; });
+        if (m_pendingDirs.empty())
+            break;
+
+        PendingDir dir = m_pendingDirs.front();
+        m_pendingDirs.pop_front();
+        ++m_busyWorkers;
+        lock.unlock();
+
+        bool listed = false;
+        std::exception_ptr loginError;
+        listing.Clear();
+        try
+        {
+            if (m_cache)
+            {
+                std::string key = ListingCache::MakeKey(m_hostname, m_port, m_anonymous ? "" : m_username, m_listCommand, dir.path);
+                m_cache->FetchListing(key, dir.path, m_listCommand, m_cacheTtl, getSession, parseLine);
+            }
+            else
+                getSession()->ListDir(dir.path.c_str(), parseLine, m_listCommand);
+
+            listed = true;
+        }
+        catch (const IPKException&)
+        {
+            if (loginFailed)
+                loginError = std::current_exception();
+
+            // session is in unknown state after the failure, the next directory gets the new one
+            delete session;
+            session = NULL;
+        }
+
+        if (loginFailed)
+        {
+            // server may limit the connections, so the directory is left to the workers which got in and this one
+            // ends, failed login is the error of the whole crawl only if nothing could be listed
+            lock.lock();
+            if (!m_error)
+                m_error = loginError;
+
+            m_pendingDirs.push_front(dir);
+            --m_busyWorkers;
+            m_workCondition.notify_all();
+            return;
+        }
+
+        if (listed)
+        {
+            std::lock_guard<std::mutex> callbackLock(m_callbackMutex);
+            listing.SetNamePrefix(JoinPath(dir.path, ""));
+            dirCallback(dir.path, listing);
+        }
+
+        lock.lock();
+        if (listed)
+        {
+            ++m_listedDirs;
+
+            // links are not followed, so we can't get into the cycle, the same directory is listed only once anyway
+            for (uint32_t i = 0; i < listing.GetEntryCount() && dir.depth < m_maxDepth; ++i)
+            {
+                if (listing.GetType(i) != DIR_ENTRY_DIR)
+                    continue;
+
+                PendingDir subDir;
+                subDir.path = JoinPath(dir.path, listing.GetName(i));
+                subDir.depth = dir.depth + 1;
+                if (m_visitedDirs.insert(subDir.path).second)
+                    m_pendingDirs.push_back(subDir);
+            }
+        }
+        else
+            m_failedDirs.push_back(dir.path);
+
+        --m_busyWorkers;
+        m_workCondition.notify_all();
+    }
+
+    lock.unlock();
+    if (!session)
+        return;
+
+    try
+    {
+        session->Disconnect();
+    }
+    catch (const IPKException&)
+    {
+        // all the work is done anyway
+    }
+
+    delete session;
+}
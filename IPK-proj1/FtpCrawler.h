@@ -0,0 +1,86 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef FTP_CRAWLER_H
+#define FTP_CRAWLER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "FtpSession.h"
+#include "DirListing.h"
+#include "ListingCache.h"
+
+#define MAX_CRAWL_SESSIONS      64
+#define UNLIMITED_DEPTH         UINT32_MAX
+
+// called for every listed directory, calls are serialized so the callback doesn't need any locking
+typedef std::function<void(const std::string& dirPath, const DirListing& listing)> CrawlDirCallback;
+
+// Walks the directory tree breadth-first. Directories waiting to be listed are kept in one shared queue, which is
+// processed by the pool of sessions, each of them logged in over its own control connection.
+class FtpCrawler
+{
+public:
+    FtpCrawler(const char* hostname, uint16_t port, const char* username, const char* password);
+
+    void SetSessionCount(uint32_t sessionCount);
+    void SetMaxDepth(uint32_t maxDepth);
+    void SetListCommand(FtpCommand listCommand);
+    void SetPipelining(bool pipelining);
+    void SetCompression(bool compression);
+    // sessions record their phases into 'trace'
+    void SetTrace(SessionTrace* trace);
+    // unchanged directories are taken from the cache, only their modification time is checked on the server
+    void SetCache(const ListingCache* cache, uint32_t cacheTtl);
+
+    // returns the number of listed directories
+    uint32_t Crawl(const char* rootPath, const CrawlDirCallback& dirCallback);
+    // directories which couldn't be listed during the last crawl
+    const std::vector<std::string>& GetFailedDirs() const;
+
+private:
+    struct PendingDir
+    {
+        std::string path;
+        uint32_t depth;
+    };
+
+    static std::string JoinPath(const std::string& dirPath, const std::string& name);
+
+    void WorkerLoop(const CrawlDirCallback& dirCallback);
+    FtpSession* CreateSession();
+
+    std::string m_hostname;
+    uint16_t m_port;
+    std::string m_username;
+    std::string m_password;
+    bool m_anonymous;
+    uint32_t m_sessionCount;
+    uint32_t m_maxDepth;
+    FtpCommand m_listCommand;
+    bool m_pipelining;
+    bool m_compression;
+    SessionTrace* m_trace;
+    const ListingCache* m_cache;
+    uint32_t m_cacheTtl;
+
+    std::deque<PendingDir> m_pendingDirs;
+    std::unordered_set<std::string> m_visitedDirs;
+    std::vector<std::string> m_failedDirs;
+    uint32_t m_busyWorkers;
+    uint32_t m_listedDirs;
+    std::exception_ptr m_error;
+    std::mutex m_mutex;
+    std::mutex m_callbackMutex;
+    std::condition_variable m_workCondition;
+};
+
+#endif // FTP_CRAWLER_H
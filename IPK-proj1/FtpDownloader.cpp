@@ -0,0 +1,153 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <exception>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "FtpDownloader.h"
+#include "IPKException.h"
+
+FtpDownloader::FtpDownloader(const char* hostname, uint16_t port, const char* username, const char* password) : m_hostname(hostname),
+    m_port(port), m_username(username ? username : ""), m_password(password ? password : ""), m_anonymous(!username),
+    m_segmentCount(1), m_resume(false), m_pipelining(false), m_compression(false), m_trace(NULL)
+{
+}
+
+void FtpDownloader::SetSegmentCount(uint32_t segmentCount)
+{
+    if (segmentCount == 0 || segmentCount > MAX_SEGMENTS)
+        throw IPKException("FtpDownloader::SetSegmentCount - invalid number of segments");
+
+    m_segmentCount = segmentCount;
+}
+
+void FtpDownloader::SetResume(bool resume)
+{
+    m_resume = resume;
+}
+
+void FtpDownloader::SetPipelining(bool pipelining)
+{
+    m_pipelining = pipelining;
+}
+
+void FtpDownloader::SetCompression(bool compression)
+{
+    m_compression = compression;
+}
+
+void FtpDownloader::SetTrace(SessionTrace* trace)
+{
+    m_trace = trace;
+}
+
+uint64_t FtpDownloader::Download(const char* remotePath, const char* localPath)
+{
+    FtpSession session(m_hostname.c_str(), m_port);
+    ConnectSession(session);
+
+    int fileFd = open(localPath, O_WRONLY | O_CREAT | (m_resume ? 0 : O_TRUNC), 0644);
+    if (fileFd == -1)
+        throw IPKException("FtpDownloader::Download - unable to open local file");
+
+    uint64_t offset = 0;
+    struct stat fileStat;
+    if (m_resume && fstat(fileFd, &fileStat) == 0)
+        offset = fileStat.st_size;
+
+    uint64_t bytesWritten = 0;
+    try
+    {
+        if (m_segmentCount == 1)
+        {
+            // no need to know the size in advance, just take everything from the offset to the end
+            bytesWritten = session.RetrieveFile(remotePath, fileFd, offset);
+        }
+        else
+        {
+            uint64_t fileSize = session.GetFileSize(remotePath);
+            if (offset > fileSize)
+                throw IPKException("FtpDownloader::Download - local file is larger than the remote one");
+
+            // small files are not worth the additional connections
+            uint64_t remaining = fileSize - offset;
+            uint32_t segmentCount = std::max<uint64_t>(1, std::min<uint64_t>(m_segmentCount, remaining / MIN_SEGMENT_SIZE));
+            uint64_t segmentSize = remaining / segmentCount;
+
+            // first segment goes over the connection we already have, the rest of them over the new ones
+            std::vector<std::thread> threads;
+            std::vector<std::exception_ptr> errors(segmentCount);
+            for (uint32_t i = 1; i < segmentCount; ++i)
+            {
+                uint64_t segmentOffset = offset + i * segmentSize;
+                uint64_t segmentLength = (i == segmentCount - 1) ? fileSize - segmentOffset : segmentSize;
+                threads.push_back(std::thread([=, &errors]()
+                {
+                    try
+                    {
+                        DownloadSegment(remotePath, fileFd, segmentOffset, segmentLength);
+                    }
+                    catch (...)
+                    {
+                        errors[i] = std::current_exception();
+                    }
+                }));
+            }
+
+            try
+            {
+                uint64_t segmentLength = (segmentCount == 1) ? remaining : segmentSize;
+                if (session.RetrieveFile(remotePath, fileFd, offset, segmentLength) != segmentLength)
+                    throw IPKException("FtpDownloader::Download - segment ended prematurely");
+            }
+            catch (...)
+            {
+                errors[0] = std::current_exception();
+            }
+
+            for (std::thread& thread : threads)
+                thread.join();
+
+            for (const std::exception_ptr& error : errors)
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            bytesWritten = remaining;
+        }
+    }
+    catch (...)
+    {
+        close(fileFd);
+        throw;
+    }
+
+    close(fileFd);
+    session.Disconnect();
+    return bytesWritten;
+}
+
+void FtpDownloader::ConnectSession(FtpSession& session)
+{
+    session.SetPipelining(m_pipelining);
+    session.SetCompression(m_compression);
+    session.SetTrace(m_trace);
+    session.Connect(m_anonymous ? NULL : m_username.c_str(), m_anonymous ? NULL : m_password.c_str());
+}
+
+void FtpDownloader::DownloadSegment(const char* remotePath, int fileFd, uint64_t offset, uint64_t length)
+{
+    FtpSession session(m_hostname.c_str(), m_port);
+    ConnectSession(session);
+
+    if (session.RetrieveFile(remotePath, fileFd, offset, length) != length)
+        throw IPKException("FtpDownloader::DownloadSegment - segment ended prematurely");
+
+    session.Disconnect();
+}
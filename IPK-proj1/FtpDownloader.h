@@ -0,0 +1,48 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef FTP_DOWNLOADER_H
+#define FTP_DOWNLOADER_H
+
+#include <cstdint>
+#include <string>
+#include "FtpSession.h"
+
+#define MAX_SEGMENTS            16
+#define MIN_SEGMENT_SIZE        (1 << 20)
+
+// Downloads one remote file into the local one. Large files can be split into byte ranges, each of them
+// fetched over its own control and data connection at the same time.
+class FtpDownloader
+{
+public:
+    FtpDownloader(const char* hostname, uint16_t port, const char* username, const char* password);
+
+    void SetSegmentCount(uint32_t segmentCount);
+    void SetResume(bool resume);
+    void SetPipelining(bool pipelining);
+    void SetCompression(bool compression);
+    // sessions record their phases into 'trace'
+    void SetTrace(SessionTrace* trace);
+
+    // returns the number of bytes downloaded
+    uint64_t Download(const char* remotePath, const char* localPath);
+
+private:
+    void ConnectSession(FtpSession& session);
+    void DownloadSegment(const char* remotePath, int fileFd, uint64_t offset, uint64_t length);
+
+    std::string m_hostname;
+    uint16_t m_port;
+    std::string m_username;
+    std::string m_password;
+    bool m_anonymous;
+    uint32_t m_segmentCount;
+    bool m_resume;
+    bool m_pipelining;
+    bool m_compression;
+    SessionTrace* m_trace;
+};
+
+#endif // FTP_DOWNLOADER_H
@@ -3,10 +3,26 @@
  * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
  **/
 #include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <strings.h>
+#include <ctime>
+#include <cstdio>
+#include <atomic>
 #include "FtpSession.h"
+#include "Inflater.h"
+#include "Logger.h"
 #include "IPKException.h"
 
-FtpSession::FtpSession(const char* hostname, uint16_t port)
+static std::atomic<uint64_t> s_lastSessionId(0);
+
+FtpSession::FtpSession(const char* hostname, uint16_t port) : m_multilineCode(0), m_binaryMode(false), m_pipelining(false),
+    m_compression(false), m_compressed(false), m_trace(NULL), m_traceId(0), m_sessionId(++s_lastSessionId)
 {
     m_cmdSocket = new Socket(hostname, port);
     m_cmdSocket->SetRecvTimeout(DEFAULT_TIMEOUT);
@@ -23,24 +39,95 @@ void FtpSession::Connect(const char* username, const char* password)
     if (username && !password)
         throw IPKException("FtpSession::Connect - username specified but no password");
 
-    m_cmdSocket->Open();
-    if (WaitForResponse() != FTP_RES_READY_TO_LOGIN)
-        throw IPKException("FtpSession::Connect - unable to login, no challenge for username");
+    Logger::SetSession(m_sessionId);
+    LogTimer connectTimer;
+    {
+        TracePhase phase(m_trace, m_traceId, "dns");
+        m_cmdSocket->Resolve();
+    }
+
+    {
+        TracePhase phase(m_trace, m_traceId, "connect");
+        m_cmdSocket->Open();
+        m_cmdSocket->Connect();
+    }
+
+    {
+        TracePhase phase(m_trace, m_traceId, "greeting", m_cmdSocket);
+        if (WaitForResponse() != FTP_RES_READY_TO_LOGIN)
+            throw IPKException("FtpSession::Connect - unable to login, no challenge for username");
+    }
 
-    SendCommand(FTP_CMD_USER, username ? username : "anonymous");
+    Login(username, password);
+
+    if (m_compression)
+        NegotiateCompression();
+
+    LOG_INFO(FTP_CMD_USER, 0, connectTimer.GetDurationUs(), "logged in to " + m_cmdSocket->GetHostname());
+}
+
+void FtpSession::Login(const char* username, const char* password)
+{
+    TracePhase phase(m_trace, m_traceId, "login", m_cmdSocket);
+
+    // pipelined login sends the password without waiting for the server to ask for it
+    QueueCommand(FTP_CMD_USER, username ? username : "anonymous");
+    if (m_pipelining)
+        QueueCommand(FTP_CMD_PASS, password ? password : "anonymous");
+
+    FlushCommands();
     uint16_t response = WaitForResponse();
     if (response == FTP_RES_SPECIFY_PASS)
     {
-        SendCommand(FTP_CMD_PASS, password ? password : "anonymous");
+        if (!m_pipelining)
+            SendCommand(FTP_CMD_PASS, password ? password : "anonymous");
+
         response = WaitForResponse();
     }
+    else if (response == FTP_RES_LOGIN_SUCCESSFUL && m_pipelining)
+    {
+        // logged in without the password, the reply to unneeded PASS doesn't matter
+        WaitForResponse();
+    }
 
     if (response != FTP_RES_LOGIN_SUCCESSFUL)
+    {
+        LOG_WARNING(FTP_CMD_PASS, 0, 0, "login refused by " + m_cmdSocket->GetHostname());
         throw IPKException("FtpSession::Connect - unable to login, invalid user");
+    }
+}
+
+void FtpSession::NegotiateCompression()
+{
+    TracePhase phase(m_trace, m_traceId, "compression", m_cmdSocket);
+    std::string features;
+
+    // pipelined session doesn't wait for the features, server which doesn't know MODE Z just refuses it
+    QueueCommand(FTP_CMD_FEAT);
+    if (m_pipelining)
+        QueueCommand(FTP_CMD_MODE, "Z");
+
+    // features are listed one per line, each indented by the space
+    bool modeZ = false;
+    if (WaitForResponse(NULL, &features) == FTP_RES_SYSTEM_STATUS)
+    {
+        for (size_t pos = 0; !modeZ && (pos = features.find('\n', pos)) != std::string::npos; ++pos)
+            modeZ = strncasecmp(features.c_str() + pos + 1, " MODE Z", 7) == 0;
+    }
+
+    // server without MODE Z is fine, transfers just stay uncompressed
+    if (m_pipelining)
+        m_compressed = (WaitForResponse() == FTP_RES_COMMAND_OK);
+    else if (modeZ)
+    {
+        SendCommand(FTP_CMD_MODE, "Z");
+        m_compressed = (WaitForResponse() == FTP_RES_COMMAND_OK);
+    }
 }
 
 void FtpSession::Disconnect()
 {
+    TracePhase phase(m_trace, m_traceId, "quit", m_cmdSocket);
     SendCommand(FTP_CMD_QUIT);
     if (WaitForResponse() != FTP_RES_GOODBYE)
         throw IPKException("FtpSession::Disconnect - didn't receive goodbye message");
@@ -48,38 +135,185 @@ void FtpSession::Disconnect()
     m_cmdSocket->Close();
 }
 
+void FtpSession::SetPipelining(bool pipelining)
+{
+    m_pipelining = pipelining;
+}
+
+void FtpSession::SetCompression(bool compression)
+{
+    m_compression = compression;
+}
+
+bool FtpSession::IsCompressed() const
+{
+    return m_compressed;
+}
+
+void FtpSession::SetTrace(SessionTrace* trace)
+{
+    m_trace = trace;
+    m_traceId = trace ? trace->NewSessionId() : 0;
+}
+
+void FtpSession::KeepAlive()
+{
+    TracePhase phase(m_trace, m_traceId, "keepalive", m_cmdSocket);
+    SendCommand(FTP_CMD_NOOP);
+    if (WaitForResponse() != FTP_RES_COMMAND_OK)
+        throw IPKException("FtpSession::KeepAlive - no response to keepalive");
+}
+
+bool FtpSession::IsAlive()
+{
+    pollfd pollFd;
+    pollFd.fd = m_cmdSocket->GetHandle();
+    pollFd.events = POLLIN;
+    pollFd.revents = 0;
+    return !m_cmdSocket->IsClosed() && poll(&pollFd, 1, 0) == 0;
+}
+
 void FtpSession::ListDir(const char* dirPath, std::string& dirList)
+{
+    ListDir(dirPath, [&dirList](const char* line, uint32_t length)
+    {
+        dirList.append(line, length);
+    });
+}
+
+void FtpSession::ListDir(const char* dirPath, const ListLineCallback& lineCallback, FtpCommand listCommand)
 {
     std::string dataIpAddr;
     uint16_t dataPort;
 
-    EnterPassiveMode(dataIpAddr, dataPort);
-    SendCommand(FTP_CMD_LIST, dirPath);
+    if (listCommand != FTP_CMD_LIST && listCommand != FTP_CMD_MLSD)
+        throw IPKException("FtpSession::ListDir - invalid listing command");
+
+    LogTimer listTimer;
+    if (m_pipelining)
+    {
+        // listing can go right behind PASV, server starts it once we open the data connection
+        QueueCommand(FTP_CMD_PASV);
+        QueueCommand(listCommand, dirPath);
+        FlushCommands();
+
+        TracePhase phase(m_trace, m_traceId, "pasv", m_cmdSocket);
+        ReadPassiveModeResponse(dataIpAddr, dataPort);
+    }
+    else
+    {
+        EnterPassiveMode(dataIpAddr, dataPort);
+        SendCommand(listCommand, dirPath);
+    }
 
-    Socket* dataSocket = new Socket(dataIpAddr.c_str(), dataPort);
-    dataSocket->Open();
+    std::unique_ptr<Socket> dataSocket(new Socket(dataIpAddr.c_str(), dataPort));
+    {
+        TracePhase phase(m_trace, m_traceId, "data_connect");
+        dataSocket->Open();
+        dataSocket->Connect();
+    }
 
+    // transfer lasts until the server confirms it, the data bytes are the ones on the wire (compressed in MODE Z)
+    TracePhase transferPhase(m_trace, m_traceId, "transfer", dataSocket.get());
     if (WaitForResponse() != FTP_RES_OPEN_DATA_CONN)
         throw IPKException("FtpSession::ListDir - cannot initiate data connection");
 
     dataSocket->SetRecvTimeout(DEFAULT_TIMEOUT);
 
-    do
+    // listing is complete once the server closes the data connection and confirms it on the control connection,
+    // wait for both of them at once so we don't have to guess by the time nothing arrives
+    pollfd pollFds[2];
+    pollFds[0].fd = dataSocket->GetHandle();
+    pollFds[0].events = POLLIN;
+    pollFds[1].fd = m_cmdSocket->GetHandle();
+    pollFds[1].events = POLLIN;
+
+    // hand over every complete line right from the received data, only the unfinished one at the end of it is copied
+    // aside to wait for the rest
+    std::string pendingLine;
+    auto splitLines = [&](const char* chunk, uint32_t dataSize)
     {
-        dataSocket->Recv();
+        uint32_t lineStart = 0;
+        while (const char* lineEnd = (const char*)memchr(chunk + lineStart, '\n', dataSize - lineStart))
+        {
+            uint32_t lineLength = lineEnd - chunk - lineStart + 1;
+            if (pendingLine.empty())
+                lineCallback(chunk + lineStart, lineLength);
+            else
+            {
+                pendingLine.append(chunk + lineStart, lineLength);
+                lineCallback(pendingLine.c_str(), pendingLine.length());
+                pendingLine.clear();
+            }
 
-        // build the directory listing chunck by chunck
-        std::vector<uint8_t> buffer = dataSocket->GetBuffer();
-        dirList.append(std::string(buffer.begin(), buffer.begin() + dataSocket->GetBufferSize()));
-        dataSocket->RewindBuffer(dataSocket->GetBufferSize());
-    }
-    while (dataSocket->IsReadyToRead(1));
+            lineStart += lineLength;
+        }
 
-    if (WaitForResponse() != FTP_RES_CLOSE_DATA_CONN)
-        throw IPKException("FtpSession::ListDir - didn't receive end of data message");
+        pendingLine.append(chunk + lineStart, dataSize - lineStart);
+    };
+
+    std::unique_ptr<Inflater> inflater;
+    if (m_compressed)
+        inflater.reset(new Inflater());
+
+    uint16_t response = 0;
+    while (!dataSocket->IsClosed() || !response)
+    {
+        // reply could have arrived together with the previous one, then it already waits in the buffer and poll won't see it
+        bool responseBuffered = !response && m_cmdSocket->GetBufferSize() > 0;
+
+        pollFds[0].revents = pollFds[1].revents = 0;
+        int ready = poll(pollFds, 2, responseBuffered ? 0 : DEFAULT_TIMEOUT * 1000);
+        if (ready == -1 && errno == EINTR)
+            continue;
+
+        if (ready <= 0 && !responseBuffered)
+            throw IPKException("FtpSession::ListDir - connection timed out");
+
+        if (responseBuffered)
+            pollFds[1].revents |= POLLIN;
+
+        if (pollFds[0].revents)
+        {
+            dataSocket->FillBuffer();
+
+            const uint8_t* data;
+            uint32_t dataSize;
+            while ((dataSize = dataSocket->GetBufferView(data)) > 0)
+            {
+                if (inflater)
+                    inflater->Inflate(data, dataSize, splitLines);
+                else
+                    splitLines((const char*)data, dataSize);
+
+                dataSocket->RewindBuffer(dataSize);
+            }
+
+            if (dataSocket->IsClosed())
+            {
+                if (inflater && !inflater->IsFinished())
+                    throw IPKException("FtpSession::ListDir - compressed listing is incomplete");
+
+                // last line may not be terminated
+                if (!pendingLine.empty())
+                    lineCallback(pendingLine.c_str(), pendingLine.length());
+
+                pollFds[0].fd = -1;
+            }
+        }
+
+        if (pollFds[1].revents)
+        {
+            response = WaitForResponse();
+            if (response != FTP_RES_CLOSE_DATA_CONN)
+                throw IPKException("FtpSession::ListDir - didn't receive end of data message");
+
+            pollFds[1].fd = -1;
+        }
+    }
 
     dataSocket->Close();
-    delete dataSocket;
+    LOG_INFO(listCommand, dataSocket->GetBytesReceived(), listTimer.GetDurationUs(), dirPath ? dirPath : "");
 }
 
 void FtpSession::ListCurrentDir(std::string& dirList)
@@ -87,7 +321,301 @@ void FtpSession::ListCurrentDir(std::string& dirList)
     ListDir(".", dirList);
 }
 
+void FtpSession::SetBinaryMode()
+{
+    if (m_binaryMode)
+        return;
+
+    TracePhase phase(m_trace, m_traceId, "type", m_cmdSocket);
+    SendCommand(FTP_CMD_TYPE, "I");
+    ExpectResponse(FTP_RES_ASCII_MODE, "FtpSession::SetBinaryMode - unable to switch to binary mode");
+    m_binaryMode = true;
+}
+
+uint64_t FtpSession::GetFileSize(const char* filePath)
+{
+    std::string responseLine;
+
+    // size in ASCII mode can differ from the real one
+    SetBinaryMode();
+
+    TracePhase phase(m_trace, m_traceId, "size", m_cmdSocket);
+    SendCommand(FTP_CMD_SIZE, filePath);
+    if (WaitForResponse(&responseLine) != FTP_RES_FILE_STATUS)
+        throw IPKException("FtpSession::GetFileSize - unable to get the size of file");
+
+    uint64_t fileSize = 0;
+    std::istringstream(responseLine.substr(4)) >> fileSize;
+    return fileSize;
+}
+
+int64_t FtpSession::GetModifyTime(const char* path)
+{
+    TracePhase phase(m_trace, m_traceId, "modify_time", m_cmdSocket);
+    std::string responseLine, responseBody;
+
+    // facts of the file come in the middle line of the multiline response
+    SendCommand(FTP_CMD_MLST, path);
+    if (WaitForResponse(NULL, &responseBody) == FTP_RES_FILE_ACTION_OK)
+    {
+        for (size_t pos = 0; (pos = responseBody.find('=', pos)) != std::string::npos; ++pos)
+        {
+            if (pos >= 6 && strncasecmp(responseBody.c_str() + pos - 6, "modify", 6) == 0)
+                return ParseModifyTime(responseBody.c_str() + pos + 1);
+        }
+    }
+
+    // MDTM is meant for files only, but many servers answer it for directories too
+    SendCommand(FTP_CMD_MDTM, path);
+    if (WaitForResponse(&responseLine) == FTP_RES_FILE_STATUS && responseLine.length() > 4)
+        return ParseModifyTime(responseLine.c_str() + 4);
+
+    return 0;
+}
+
+int64_t FtpSession::ParseModifyTime(const char* timeStr)
+{
+    // YYYYMMDDHHMMSS[.sss]
+    tm modifyTm;
+    memset(&modifyTm, 0, sizeof(tm));
+    if (sscanf(timeStr, "%4d%2d%2d%2d%2d%2d", &modifyTm.tm_year, &modifyTm.tm_mon, &modifyTm.tm_mday, &modifyTm.tm_hour,
+        &modifyTm.tm_min, &modifyTm.tm_sec) != 6)
+        return 0;
+
+    modifyTm.tm_year -= 1900;
+    modifyTm.tm_mon -= 1;
+    return timegm(&modifyTm);
+}
+
+uint64_t FtpSession::RetrieveFile(const char* filePath, int fileFd, uint64_t offset, uint64_t length)
+{
+    std::string dataIpAddr;
+    uint16_t dataPort;
+
+    std::ostringstream offsetStr;
+    offsetStr << offset;
+    LogTimer retrieveTimer;
+    if (m_pipelining)
+    {
+        // nothing depends on the replies before RETR, so all the commands leave at once and replies come back in order
+        bool switchMode = !m_binaryMode;
+        if (switchMode)
+            QueueCommand(FTP_CMD_TYPE, "I");
+
+        QueueCommand(FTP_CMD_PASV);
+        if (offset)
+            QueueCommand(FTP_CMD_REST, offsetStr.str().c_str());
+
+        QueueCommand(FTP_CMD_RETR, filePath);
+        FlushCommands();
+
+        if (switchMode)
+        {
+            TracePhase phase(m_trace, m_traceId, "type", m_cmdSocket);
+            ExpectResponse(FTP_RES_ASCII_MODE, "FtpSession::RetrieveFile - unable to switch to binary mode");
+            m_binaryMode = true;
+        }
+
+        {
+            TracePhase phase(m_trace, m_traceId, "pasv", m_cmdSocket);
+            ReadPassiveModeResponse(dataIpAddr, dataPort);
+        }
+
+        if (offset)
+        {
+            TracePhase phase(m_trace, m_traceId, "rest", m_cmdSocket);
+            ExpectResponse(FTP_RES_PENDING_INFO, "FtpSession::RetrieveFile - server doesn't support restarting of transfer");
+        }
+    }
+    else
+    {
+        SetBinaryMode();
+        EnterPassiveMode(dataIpAddr, dataPort);
+
+        if (offset)
+        {
+            TracePhase phase(m_trace, m_traceId, "rest", m_cmdSocket);
+            SendCommand(FTP_CMD_REST, offsetStr.str().c_str());
+            ExpectResponse(FTP_RES_PENDING_INFO, "FtpSession::RetrieveFile - server doesn't support restarting of transfer");
+        }
+
+        SendCommand(FTP_CMD_RETR, filePath);
+    }
+
+    std::unique_ptr<Socket> dataSocket(new Socket(dataIpAddr.c_str(), dataPort));
+    {
+        TracePhase phase(m_trace, m_traceId, "data_connect");
+        dataSocket->Open();
+        dataSocket->Connect();
+    }
+
+    // transfer lasts until the server confirms it, the data bytes are the ones on the wire (compressed in MODE Z)
+    TracePhase transferPhase(m_trace, m_traceId, "transfer", dataSocket.get());
+    uint16_t response = WaitForResponse();
+    if (response != FTP_RES_OPEN_DATA_CONN && response != FTP_RES_DATA_CONN_OPENED)
+        throw IPKException("FtpSession::RetrieveFile - cannot initiate data connection");
+
+    dataSocket->SetRecvTimeout(DEFAULT_TIMEOUT);
+
+    // compressed data has to pass through the user space anyway
+    uint64_t bytesWritten;
+    if (m_compressed)
+        bytesWritten = InflateData(dataSocket.get(), fileFd, offset, length);
+    else
+        bytesWritten = SpliceData(dataSocket.get(), fileFd, offset, length);
+
+    // spliced data don't pass through the socket buffer, so the socket doesn't count them
+    if (!m_compressed && dataSocket->GetBytesReceived() < bytesWritten)
+        transferPhase.AddBytesReceived(bytesWritten - dataSocket->GetBytesReceived());
+
+    dataSocket->Close();
+
+    // closing the data connection before the end of file (only part of it requested) makes the server to abort the transfer
+    response = WaitForResponse();
+    bool aborted = (length != WHOLE_FILE && bytesWritten == length);
+    if (response != FTP_RES_CLOSE_DATA_CONN && !(aborted && response >= 400 && response < 500))
+        throw IPKException("FtpSession::RetrieveFile - didn't receive end of data message");
+
+    LOG_INFO(FTP_CMD_RETR, bytesWritten, retrieveTimer.GetDurationUs(), filePath);
+    return bytesWritten;
+}
+
+uint64_t FtpSession::SpliceData(Socket* dataSocket, int fileFd, uint64_t offset, uint64_t length)
+{
+    // data go from the socket to the file through the pipe without being copied to the user space
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0)
+        return CopyData(dataSocket, fileFd, offset, length);
+
+    uint64_t bytesWritten = 0;
+    loff_t fileOffset = offset;
+    while (bytesWritten < length)
+    {
+        ssize_t bytesIn = splice(dataSocket->GetHandle(), NULL, pipeFds[1], NULL, std::min<uint64_t>(length - bytesWritten, SPLICE_CHUNK_SIZE),
+            SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (bytesIn == 0)
+            break;
+
+        if (bytesIn == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            close(pipeFds[0]);
+            close(pipeFds[1]);
+
+            // file or socket doesn't support splicing, nothing was transferred yet so we can fall back to copying
+            if (errno == EINVAL && bytesWritten == 0)
+                return CopyData(dataSocket, fileFd, offset, length);
+
+            throw IPKException("FtpSession::SpliceData - error while receiving data");
+        }
+
+        while (bytesIn > 0)
+        {
+            ssize_t bytesOut = splice(pipeFds[0], NULL, fileFd, &fileOffset, bytesIn, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (bytesOut == -1 && errno == EINTR)
+                continue;
+
+            if (bytesOut <= 0)
+            {
+                close(pipeFds[0]);
+                close(pipeFds[1]);
+                throw IPKException("FtpSession::SpliceData - error while writing data");
+            }
+
+            bytesIn -= bytesOut;
+            bytesWritten += bytesOut;
+        }
+    }
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return bytesWritten;
+}
+
+uint64_t FtpSession::CopyData(Socket* dataSocket, int fileFd, uint64_t offset, uint64_t length)
+{
+    uint64_t bytesWritten = 0;
+    while (bytesWritten < length && !dataSocket->IsClosed())
+    {
+        dataSocket->FillBuffer();
+
+        const uint8_t* data;
+        uint32_t dataSize;
+        while ((dataSize = dataSocket->GetBufferView(data)) > 0)
+        {
+            dataSize = std::min<uint64_t>(dataSize, length - bytesWritten);
+            if (pwrite(fileFd, data, dataSize, offset + bytesWritten) != dataSize)
+                throw IPKException("FtpSession::CopyData - error while writing data");
+
+            dataSocket->RewindBuffer(dataSize);
+            bytesWritten += dataSize;
+            if (bytesWritten == length)
+                break;
+        }
+    }
+
+    return bytesWritten;
+}
+
+uint64_t FtpSession::InflateData(Socket* dataSocket, int fileFd, uint64_t offset, uint64_t length)
+{
+    Inflater inflater;
+    uint64_t bytesWritten = 0;
+    auto writeData = [&](const char* data, uint32_t dataSize)
+    {
+        // rest of the decompressed data past the requested range is thrown away
+        dataSize = std::min<uint64_t>(dataSize, length - bytesWritten);
+        if (pwrite(fileFd, data, dataSize, offset + bytesWritten) != dataSize)
+            throw IPKException("FtpSession::InflateData - error while writing data");
+
+        bytesWritten += dataSize;
+    };
+
+    while (bytesWritten < length && !dataSocket->IsClosed())
+    {
+        dataSocket->FillBuffer();
+
+        const uint8_t* data;
+        uint32_t dataSize;
+        while (bytesWritten < length && (dataSize = dataSocket->GetBufferView(data)) > 0)
+        {
+            inflater.Inflate(data, dataSize, writeData);
+            dataSocket->RewindBuffer(dataSize);
+        }
+    }
+
+    // range of the file can end anywhere in the stream, only the whole file has to reach its end
+    if (length == WHOLE_FILE && !inflater.IsFinished())
+        throw IPKException("FtpSession::InflateData - compressed data are incomplete");
+
+    return bytesWritten;
+}
+
 void FtpSession::SendCommand(FtpCommand command, const char* arg)
+{
+    QueueCommand(command, arg);
+    FlushCommands();
+}
+
+void FtpSession::FlushCommands()
+{
+    if (m_commandQueue.empty())
+        return;
+
+    // queued commands leave in the single write, so they usually share one segment
+    m_cmdSocket->Send(m_commandQueue.c_str(), m_commandQueue.length());
+    m_commandQueue.clear();
+}
+
+void FtpSession::ExpectResponse(uint16_t expectedResponse, const char* errorMessage)
+{
+    if (WaitForResponse() != expectedResponse)
+        throw IPKException(errorMessage);
+}
+
+void FtpSession::QueueCommand(FtpCommand command, const char* arg)
 {
     std::stringstream dataBuffer;
 
@@ -113,6 +641,59 @@ void FtpSession::SendCommand(FtpCommand command, const char* arg)
             if (arg)
                 dataBuffer << " " << arg;
             break;
+        case FTP_CMD_MLSD:
+            dataBuffer << "MLSD";
+            if (arg)
+                dataBuffer << " " << arg;
+            break;
+        case FTP_CMD_TYPE:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_TYPE - no arg specified");
+
+            dataBuffer << "TYPE " << arg;
+            break;
+        case FTP_CMD_RETR:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_RETR - no arg specified");
+
+            dataBuffer << "RETR " << arg;
+            break;
+        case FTP_CMD_REST:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_REST - no arg specified");
+
+            dataBuffer << "REST " << arg;
+            break;
+        case FTP_CMD_SIZE:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_SIZE - no arg specified");
+
+            dataBuffer << "SIZE " << arg;
+            break;
+        case FTP_CMD_NOOP:
+            dataBuffer << "NOOP";
+            break;
+        case FTP_CMD_MLST:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_MLST - no arg specified");
+
+            dataBuffer << "MLST " << arg;
+            break;
+        case FTP_CMD_MDTM:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_MDTM - no arg specified");
+
+            dataBuffer << "MDTM " << arg;
+            break;
+        case FTP_CMD_FEAT:
+            dataBuffer << "FEAT";
+            break;
+        case FTP_CMD_MODE:
+            if (!arg)
+                throw IPKException("FtpSession::SendCommand - FTP_CMD_MODE - no arg specified");
+
+            dataBuffer << "MODE " << arg;
+            break;
         case FTP_CMD_QUIT:
             dataBuffer << "QUIT";
             break;
@@ -120,96 +701,109 @@ void FtpSession::SendCommand(FtpCommand command, const char* arg)
             throw IPKException("FtpSession::SendCommand - unknown command");
     }
 
+    // the session may have moved to the other thread since its last command, the password never gets into the log
+    Logger::SetSession(m_sessionId);
+    LOG_DEBUG(command, 0, 0, command == FTP_CMD_PASS ? std::string("PASS ****") : dataBuffer.str());
+
     dataBuffer << "\r\n";
-    m_cmdSocket->Send(dataBuffer.str().c_str(), dataBuffer.str().length());
+    m_commandQueue.append(dataBuffer.str());
 }
 
 void FtpSession::EnterPassiveMode(std::string& ipAddr, uint16_t& port)
 {
-    std::vector<uint8_t> responseBuffer;
-
+    TracePhase phase(m_trace, m_traceId, "pasv", m_cmdSocket);
     SendCommand(FTP_CMD_PASV);
-    if (WaitForResponse(&responseBuffer) != FTP_RES_PASSIVE_MODE)
+    ReadPassiveModeResponse(ipAddr, port);
+}
+
+void FtpSession::ReadPassiveModeResponse(std::string& ipAddr, uint16_t& port)
+{
+    std::string responseLine;
+
+    if (WaitForResponse(&responseLine) != FTP_RES_PASSIVE_MODE)
         throw IPKException("FtpSession::EnterPassiveMode - unable to enter passive mode");
 
-    ParseIPAddressAndPort(responseBuffer, ipAddr, port);
+    ParseIPAddressAndPort(responseLine, ipAddr, port);
 }
 
-uint16_t FtpSession::WaitForResponse(std::vector<uint8_t>* responseBuffer)
+uint16_t FtpSession::WaitForResponse(std::string* responseLine, std::string* responseBody)
 {
-    // there is possible message to parse, try no to receive new packets if we have something in buffer
-    bool needRecv = m_cmdSocket->GetBufferSize() < 6 ? true : false;
+    // reply can't come to the command which is still waiting in the queue
+    FlushCommands();
+
     uint16_t responseCode = 0;
 
-    while (!responseCode)
+    // parse what is already in the buffer first, receive only if the response isn't complete yet
+    while (!ParseResponse(responseCode))
     {
-        if (needRecv)
+        if (m_cmdSocket->IsClosed())
+            return 0;
+
+        // Socket::Recv throws exceptions, but the WaitForResponse() conditions throw them too, so this can cause
+        // unwanted termination, catch the exception from Socket::Recv here and then just return 0 so the superior
+        // exceptions can be properly raised
+        try
         {
-            // Socket::Recv throws exceptions, but the WaitForResponse() conditions throw them too, so this can cause
-            // unwanted termination, catch the exception from Socket::Recv here and then just return 0 so the superior
-            // exceptions can be properly raised
-            try
-            {
-                m_cmdSocket->Recv();
-            }
-            catch (const IPKException& ex)
-            {
-                return 0;
-            }
+            m_cmdSocket->FillBuffer();
+        }
+        catch (const IPKException& ex)
+        {
+            return 0;
         }
+    }
 
-        std::vector<uint8_t> buffer = m_cmdSocket->GetBuffer();
-        uint32_t bufferSize = m_cmdSocket->GetBufferSize();
+    if (responseLine)
+        responseLine->assign(m_responseLine);
 
-        // we don't have enough data to parse out message
-        if (bufferSize < 6)
-        {
-            needRecv = true;
+    if (responseBody)
+        responseBody->assign(m_responseBody);
+
+    m_responseLine.clear();
+    m_responseBody.clear();
+    return responseCode;
+}
+
+bool FtpSession::ParseResponse(uint16_t& responseCode)
+{
+    const uint8_t* data;
+    uint32_t dataSize;
+
+    // every received byte is looked at only once, unfinished line waits in m_responseLine for the rest of it
+    while ((dataSize = m_cmdSocket->GetBufferView(data)) > 0)
+    {
+        const uint8_t* lineEnd = (const uint8_t*)memchr(data, '\n', dataSize);
+        uint32_t consumed = lineEnd ? (lineEnd - data + 1) : dataSize;
+        m_responseLine.append((const char*)data, consumed);
+        m_cmdSocket->RewindBuffer(consumed);
+
+        if (!lineEnd)
             continue;
-        }
 
-        // not response message, find \r\n or end of buffer and throw this message out
-        if (!isdigit(buffer[0]) || !isdigit(buffer[1]) || !isdigit(buffer[2]) || buffer[3] != ' ')
-        {
-            uint32_t rewindCount = bufferSize; // defaultly throw out the whole buffer
-            for (uint32_t i = 4; i < bufferSize - 1; ++i)
-            {
-                // try to find \r\n and throw out only <beginning of buffer;position of \r\n>
-                if (buffer[i] == '\r' && buffer[i + 1] == '\n')
-                {
-                    rewindCount = i + 2;
-                    needRecv = ((i + 2) == bufferSize) ? true : false;
-                    break;
-                }
-            }
+        const std::string& line = m_responseLine;
+        bool hasCode = line.length() >= 4 && isdigit(line[0]) && isdigit(line[1]) && isdigit(line[2]);
+        uint16_t lineCode = hasCode ? ((line[0] - '0') * 100 + (line[1] - '0') * 10 + (line[2] - '0')) : 0;
 
-            m_cmdSocket->RewindBuffer(rewindCount);
-        }
-        // response message, parse out response code and rewind buffer leaving after the response message there
-        else
+        // first line of the multiline response, the response ends with the line with the same code followed by space
+        if (hasCode && line[3] == '-' && !m_multilineCode)
+            m_multilineCode = lineCode;
+        else if (hasCode && line[3] == ' ' && (!m_multilineCode || m_multilineCode == lineCode))
         {
-            for (uint32_t i = 4; i < bufferSize - 1; ++i)
-            {
-                if (buffer[i] == '\r' && buffer[i + 1] == '\n')
-                {
-                    if (responseBuffer)
-                    {
-                        responseBuffer->resize(i + 2);
-                        std::copy(buffer.begin(), buffer.begin() + i + 2, responseBuffer->begin());
-                    }
-
-                    m_cmdSocket->RewindBuffer(i + 2);
-                    responseCode = ((buffer[0] - '0') * 100 + (buffer[1] - '0') * 10 + (buffer[2] - '0'));
-                    break;
-                }
-            }
+            m_multilineCode = 0;
+            responseCode = lineCode;
+            return true;
         }
+
+        // not the final response line, only the lines of multiline response are kept
+        if (m_multilineCode)
+            m_responseBody.append(m_responseLine);
+
+        m_responseLine.clear();
     }
 
-    return responseCode;
+    return false;
 }
 
-void FtpSession::ParseIPAddressAndPort(const std::vector<uint8_t>& buffer, std::string& ipAddr, uint16_t& port)
+void FtpSession::ParseIPAddressAndPort(const std::string& buffer, std::string& ipAddr, uint16_t& port)
 {
     std::stringstream ipAddrStr;
     uint32_t dotCount = 0;
@@ -8,10 +8,14 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <functional>
 #include "Socket.h"
+#include "SessionTrace.h"
 
 #define DEFAULT_FTP_PORT        21
 #define DEFAULT_TIMEOUT         60
+#define SPLICE_CHUNK_SIZE       (1 << 20)
+#define WHOLE_FILE              UINT64_MAX
 
 enum FtpCommand
 {
@@ -20,21 +24,39 @@ enum FtpCommand
     FTP_CMD_TYPE,
     FTP_CMD_PASV,
     FTP_CMD_LIST,
-    FTP_CMD_QUIT
+    FTP_CMD_QUIT,
+    FTP_CMD_MLSD,
+    FTP_CMD_RETR,
+    FTP_CMD_REST,
+    FTP_CMD_SIZE,
+    FTP_CMD_NOOP,
+    FTP_CMD_MLST,
+    FTP_CMD_MDTM,
+    FTP_CMD_FEAT,
+    FTP_CMD_MODE
 };
 
 enum FtpResult
 {
+    FTP_RES_DATA_CONN_OPENED    = 125,
     FTP_RES_OPEN_DATA_CONN      = 150,
+    FTP_RES_COMMAND_OK          = 200,
     FTP_RES_ASCII_MODE          = 200,
+    FTP_RES_SYSTEM_STATUS       = 211,
+    FTP_RES_FILE_STATUS         = 213,
     FTP_RES_READY_TO_LOGIN      = 220,
     FTP_RES_CLOSE_DATA_CONN     = 226,
     FTP_RES_PASSIVE_MODE        = 227,
     FTP_RES_LOGIN_SUCCESSFUL    = 230,
+    FTP_RES_FILE_ACTION_OK      = 250,
     FTP_RES_SPECIFY_PASS        = 331,
+    FTP_RES_PENDING_INFO        = 350,
     FTP_RES_GOODBYE             = 221
 };
 
+// called for each line of the listing as soon as it is received, line includes its terminator (if any)
+typedef std::function<void(const char* line, uint32_t length)> ListLineCallback;
+
 class FtpSession
 {
 public:
@@ -43,19 +65,64 @@ public:
 
     void Connect(const char* username = NULL, const char* password = NULL);
     void Disconnect();
+    void KeepAlive();
+    // pipelined session sends the commands ahead of the replies where it doesn't change their meaning, has to be set
+    // before Connect()
+    void SetPipelining(bool pipelining);
+    // compressed session transfers all the data in MODE Z if the server offers it, has to be set before Connect()
+    void SetCompression(bool compression);
+    // MODE Z was negotiated with the server
+    bool IsCompressed() const;
+    // phases of the session are recorded into 'trace' from now on
+    void SetTrace(SessionTrace* trace);
+    // idle control connection has nothing to read, otherwise server closed it or sent the timeout notice
+    bool IsAlive();
 
     void ListDir(const char* dirPath, std::string& dirList);
+    void ListDir(const char* dirPath, const ListLineCallback& lineCallback, FtpCommand listCommand = FTP_CMD_LIST);
     void ListCurrentDir(std::string& dirList);
 
+    void     SetBinaryMode();
+    uint64_t GetFileSize(const char* filePath);
+    // last modification time in UTC (from MLST or MDTM), 0 if the server doesn't tell
+    int64_t  GetModifyTime(const char* path);
+    // downloads 'length' bytes of the remote file starting at 'offset' into 'fileFd' at the same offset,
+    // returns the number of bytes written
+    uint64_t RetrieveFile(const char* filePath, int fileFd, uint64_t offset = 0, uint64_t length = WHOLE_FILE);
+
 private:
     void     SendCommand(FtpCommand command, const char* arg = NULL);
-    uint16_t WaitForResponse(std::vector<uint8_t>* responseBuffer = NULL);
+    void     QueueCommand(FtpCommand command, const char* arg = NULL);
+    void     FlushCommands();
+    void     ExpectResponse(uint16_t expectedResponse, const char* errorMessage);
+    uint16_t WaitForResponse(std::string* responseLine = NULL, std::string* responseBody = NULL);
+    bool     ParseResponse(uint16_t& responseCode);
     void     EnterPassiveMode(std::string& ipAddr, uint16_t& port);
+    void     ReadPassiveModeResponse(std::string& ipAddr, uint16_t& port);
+    void     Login(const char* username, const char* password);
+    void     NegotiateCompression();
 
-    void ParseIPAddressAndPort(const std::vector<uint8_t>& buffer, std::string& ipAddr, unsigned short& port);
+    static int64_t ParseModifyTime(const char* timeStr);
 
-    Socket* m_cmdSocket;
+    void ParseIPAddressAndPort(const std::string& buffer, std::string& ipAddr, unsigned short& port);
 
+    uint64_t SpliceData(Socket* dataSocket, int fileFd, uint64_t offset, uint64_t length);
+    uint64_t CopyData(Socket* dataSocket, int fileFd, uint64_t offset, uint64_t length);
+    uint64_t InflateData(Socket* dataSocket, int fileFd, uint64_t offset, uint64_t length);
+
+    Socket* m_cmdSocket;
+    std::string m_responseLine;
+    std::string m_responseBody;
+    uint16_t m_multilineCode;
+    bool m_binaryMode;
+    bool m_pipelining;
+    bool m_compression;
+    bool m_compressed;
+    std::string m_commandQueue;
+    SessionTrace* m_trace;
+    uint32_t m_traceId;
+    // log records of the thread carry the id of the session which sent the last command
+    uint64_t m_sessionId;
 };
 
 #endif // FTP_SESSION_H
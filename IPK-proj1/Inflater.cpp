@@ -0,0 +1,58 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <cstring>
+#include <string>
+#include "Inflater.h"
+#include "IPKException.h"
+
+Inflater::Inflater() : m_outBuffer(INFLATE_BUFFER_SIZE), m_finished(false)
+{
+    memset(&m_stream, 0, sizeof(z_stream));
+    if (inflateInit(&m_stream) != Z_OK)
+        throw IPKException("Inflater::Inflater - unable to initialize decompression");
+}
+
+Inflater::~Inflater()
+{
+    inflateEnd(&m_stream);
+}
+
+bool Inflater::IsFinished() const
+{
+    return m_finished;
+}
+
+void Inflater::Inflate(const uint8_t* data, uint32_t dataSize, const InflateCallback& outputCallback)
+{
+    m_stream.next_in = const_cast<Bytef*>(data);
+    m_stream.avail_in = dataSize;
+
+    // output buffer may fill up before all the input is consumed, so keep going until neither has anything left
+    do
+    {
+        // some servers compress each block of the transfer as the separate stream
+        if (m_finished)
+        {
+            if (m_stream.avail_in == 0)
+                break;
+
+            inflateReset(&m_stream);
+            m_finished = false;
+        }
+
+        m_stream.next_out = (Bytef*)m_outBuffer.data();
+        m_stream.avail_out = m_outBuffer.size();
+
+        int result = inflate(&m_stream, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+            throw IPKException("Inflater::Inflate - corrupted compressed data");
+
+        uint32_t outputSize = m_outBuffer.size() - m_stream.avail_out;
+        if (outputSize)
+            outputCallback(m_outBuffer.data(), outputSize);
+
+        m_finished = (result == Z_STREAM_END);
+    } while (m_stream.avail_in > 0 || m_stream.avail_out == 0);
+}
@@ -0,0 +1,39 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <zlib.h>
+
+#define INFLATE_BUFFER_SIZE     65536
+
+// called with every piece of decompressed data, it is valid only during the call
+typedef std::function<void(const char* data, uint32_t length)> InflateCallback;
+
+// Streaming decompression of the data connection in MODE Z, data can be given in pieces of any size as they come
+// from the socket.
+class Inflater
+{
+public:
+    Inflater();
+    ~Inflater();
+
+    void Inflate(const uint8_t* data, uint32_t dataSize, const InflateCallback& outputCallback);
+    // whole compressed stream was received
+    bool IsFinished() const;
+
+private:
+    Inflater(const Inflater&);
+    Inflater& operator=(const Inflater&);
+
+    z_stream m_stream;
+    std::vector<char> m_outBuffer;
+    bool m_finished;
+};
+
+#endif // INFLATER_H
@@ -0,0 +1,259 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ListingCache.h"
+#include "IPKException.h"
+
+#define FNV_OFFSET_BASIS    0xCBF29CE484222325ULL
+#define FNV_PRIME           0x100000001B3ULL
+
+CachedListing::CachedListing() : m_mapping(NULL), m_mappingSize(0), m_header(NULL), m_data(NULL)
+{
+}
+
+CachedListing::~CachedListing()
+{
+    Unmap();
+}
+
+void CachedListing::Unmap()
+{
+    if (m_mapping)
+        munmap(m_mapping, m_mappingSize);
+
+    m_mapping = NULL;
+    m_mappingSize = 0;
+    m_header = NULL;
+    m_data = NULL;
+}
+
+bool CachedListing::IsValid() const
+{
+    return m_header != NULL;
+}
+
+const char* CachedListing::GetData() const
+{
+    return m_data;
+}
+
+uint64_t CachedListing::GetDataLength() const
+{
+    return m_header->dataLength;
+}
+
+int64_t CachedListing::GetStoredTime() const
+{
+    return m_header->storedTime;
+}
+
+int64_t CachedListing::GetDirModifyTime() const
+{
+    return m_header->dirModifyTime;
+}
+
+void CachedListing::ForEachLine(const ListLineCallback& lineCallback) const
+{
+    const char* lineStart = m_data;
+    const char* dataEnd = m_data + m_header->dataLength;
+    while (lineStart < dataEnd)
+    {
+        const char* lineEnd = (const char*)memchr(lineStart, '\n', dataEnd - lineStart);
+        uint32_t length = (lineEnd ? lineEnd + 1 : dataEnd) - lineStart;
+        lineCallback(lineStart, length);
+        lineStart += length;
+    }
+}
+
+ListingCache::ListingCache(const std::string& cacheDir) : m_cacheDir(cacheDir), m_writeWarned(false)
+{
+    while (m_cacheDir.length() > 1 && m_cacheDir[m_cacheDir.length() - 1] == '/')
+        m_cacheDir.erase(m_cacheDir.length() - 1);
+
+    // create the whole path if it doesn't exist, the search starts at 1 so the leading slash isn't taken for a component
+    for (size_t pos = 0; pos != std::string::npos; )
+    {
+        pos = m_cacheDir.find('/', pos + 1);
+        std::string dir = m_cacheDir.substr(0, pos);
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+            throw IPKException("ListingCache::ListingCache - unable to create cache directory");
+    }
+}
+
+std::string ListingCache::MakeKey(const std::string& hostname, uint16_t port, const std::string& username, FtpCommand listCommand,
+    const std::string& dirPath)
+{
+    // LIST and MLSD give different outputs for the same directory
+    std::ostringstream key;
+    key << (username.empty() ? "anonymous" : username) << '@' << hostname << ':' << port << ' '
+        << (listCommand == FTP_CMD_MLSD ? "MLSD" : "LIST") << ' ' << dirPath;
+    return key.str();
+}
+
+std::string ListingCache::GetEntryPath(const std::string& key) const
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < key.length(); ++i)
+        hash = (hash ^ (uint8_t)key[i]) * FNV_PRIME;
+
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "/%016llx.lst", (unsigned long long)hash);
+    return m_cacheDir + fileName;
+}
+
+bool ListingCache::Lookup(const std::string& key, CachedListing& listing) const
+{
+    listing.Unmap();
+
+    int fd = open(GetEntryPath(key).c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size < sizeof(CacheEntryHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    // entry is never modified in place except the header fields, new version of it is a new file
+    void* mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    listing.m_mapping = mapping;
+    listing.m_mappingSize = fileStat.st_size;
+
+    const CacheEntryHeader* header = (const CacheEntryHeader*)mapping;
+    const char* entryKey = (const char*)mapping + sizeof(CacheEntryHeader);
+    // lengths are checked against what is left, so the corrupted ones can't overflow the sum
+    uint64_t payloadSize = fileStat.st_size - sizeof(CacheEntryHeader);
+    if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION
+        || header->keyLength > payloadSize || header->dataLength != payloadSize - header->keyLength
+        || header->keyLength != key.length() || memcmp(entryKey, key.c_str(), key.length()) != 0)
+    {
+        listing.Unmap();
+        return false;
+    }
+
+    listing.m_header = header;
+    listing.m_data = entryKey + header->keyLength;
+    return true;
+}
+
+void ListingCache::Store(const std::string& key, int64_t dirModifyTime, const std::string& data) const
+{
+    CacheEntryHeader header;
+    memset(&header, 0, sizeof(CacheEntryHeader));
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.storedTime = time(NULL);
+    header.keyLength = key.length();
+    header.dataLength = data.length();
+
+    // modification times have only one second resolution, changes within the same second as the listing wouldn't be
+    // noticed, so such a time isn't trusted
+    header.dirModifyTime = (dirModifyTime < header.storedTime - 1) ? dirModifyTime : 0;
+
+    std::string tempPath = m_cacheDir + "/.entry.XXXXXX";
+    std::vector<char> tempPathBuffer(tempPath.begin(), tempPath.end());
+    tempPathBuffer.push_back('\0');
+
+    int fd = mkstemp(tempPathBuffer.data());
+    if (fd == -1)
+        throw IPKException("ListingCache::Store - unable to create cache entry");
+
+    bool written = write(fd, &header, sizeof(CacheEntryHeader)) == sizeof(CacheEntryHeader)
+        && write(fd, key.c_str(), key.length()) == (ssize_t)key.length()
+        && write(fd, data.c_str(), data.length()) == (ssize_t)data.length();
+    close(fd);
+
+    // readers see either the old entry or the new one, never the half-written one
+    if (!written || rename(tempPathBuffer.data(), GetEntryPath(key).c_str()) != 0)
+    {
+        unlink(tempPathBuffer.data());
+        throw IPKException("ListingCache::Store - unable to write cache entry");
+    }
+}
+
+void ListingCache::Touch(const std::string& key) const
+{
+    int fd = open(GetEntryPath(key).c_str(), O_WRONLY);
+    if (fd == -1)
+        return;
+
+    int64_t storedTime = time(NULL);
+    if (pwrite(fd, &storedTime, sizeof(storedTime), offsetof(CacheEntryHeader, storedTime)) != sizeof(storedTime))
+    {
+        close(fd);
+        throw IPKException("ListingCache::Touch - unable to update cache entry");
+    }
+
+    close(fd);
+}
+
+void ListingCache::FetchListing(const std::string& key, const std::string& dirPath, FtpCommand listCommand, uint32_t ttl,
+    const std::function<FtpSession*()>& getSession, const ListLineCallback& lineCallback) const
+{
+    CachedListing cached;
+    bool found = Lookup(key, cached);
+    if (found && time(NULL) - cached.GetStoredTime() < (int64_t)ttl)
+    {
+        cached.ForEachLine(lineCallback);
+        return;
+    }
+
+    // modification time is taken before the listing, so the change made during it is noticed the next time
+    FtpSession* session = getSession();
+    int64_t dirModifyTime = session->GetModifyTime(dirPath.empty() ? "." : dirPath.c_str());
+    if (found && dirModifyTime && dirModifyTime == cached.GetDirModifyTime())
+    {
+        try
+        {
+            Touch(key);
+        }
+        catch (const IPKException& ex)
+        {
+            WarnWriteFailed(ex);
+        }
+
+        cached.ForEachLine(lineCallback);
+        return;
+    }
+
+    std::string data;
+    session->ListDir(dirPath.c_str(), [&](const char* line, uint32_t length)
+    {
+        data.append(line, length);
+        lineCallback(line, length);
+    }, listCommand);
+
+    // the listing has already been handed over, the cache only misses it the next time
+    try
+    {
+        Store(key, dirModifyTime, data);
+    }
+    catch (const IPKException& ex)
+    {
+        WarnWriteFailed(ex);
+    }
+}
+
+void ListingCache::WarnWriteFailed(const IPKException& ex) const
+{
+    if (!m_writeWarned.exchange(true))
+        std::cerr << ex.what() << ", listings are not cached" << std::endl;
+}
@@ -0,0 +1,90 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef LISTING_CACHE_H
+#define LISTING_CACHE_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <atomic>
+#include <functional>
+#include "FtpSession.h"
+#include "IPKException.h"
+
+#define CACHE_MAGIC             0x4C435046 // "FPCL"
+#define CACHE_VERSION           1
+#define DEFAULT_CACHE_TTL       60
+
+struct CacheEntryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t storedTime;
+    int64_t dirModifyTime;
+    uint32_t keyLength;
+    uint32_t reserved;
+    uint64_t dataLength;
+};
+
+// Cached listing mapped into the memory, the data are exactly what the server has sent.
+class CachedListing
+{
+public:
+    CachedListing();
+    ~CachedListing();
+
+    bool IsValid() const;
+    const char* GetData() const;
+    uint64_t GetDataLength() const;
+    int64_t GetStoredTime() const;
+    int64_t GetDirModifyTime() const;
+
+    void ForEachLine(const ListLineCallback& lineCallback) const;
+
+private:
+    friend class ListingCache;
+
+    CachedListing(const CachedListing&);
+    CachedListing& operator=(const CachedListing&);
+
+    void Unmap();
+
+    void* m_mapping;
+    uint64_t m_mappingSize;
+    const CacheEntryHeader* m_header;
+    const char* m_data;
+};
+
+// Listings stored on the disk, one file per directory. Files are replaced atomically, so the cache can be shared
+// by the threads and by more running clients at once.
+class ListingCache
+{
+public:
+    ListingCache(const std::string& cacheDir);
+
+    static std::string MakeKey(const std::string& hostname, uint16_t port, const std::string& username, FtpCommand listCommand,
+        const std::string& dirPath);
+
+    bool Lookup(const std::string& key, CachedListing& listing) const;
+    void Store(const std::string& key, int64_t dirModifyTime, const std::string& data) const;
+    // marks the entry as verified just now without rewriting the data
+    void Touch(const std::string& key) const;
+
+    // gives the listing to 'lineCallback', from the cache while it is younger than 'ttl' seconds or the directory hasn't
+    // been modified since, 'getSession' is called only when the server has to be asked, failed cache writes don't fail
+    // the listing
+    void FetchListing(const std::string& key, const std::string& dirPath, FtpCommand listCommand, uint32_t ttl,
+        const std::function<FtpSession*()>& getSession, const ListLineCallback& lineCallback) const;
+
+private:
+    std::string GetEntryPath(const std::string& key) const;
+    // only the first failure is reported, full or read-only cache would fail every single write
+    void WarnWriteFailed(const IPKException& ex) const;
+
+    std::string m_cacheDir;
+    mutable std::atomic_bool m_writeWarned;
+};
+
+#endif // LISTING_CACHE_H
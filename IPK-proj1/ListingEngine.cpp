@@ -0,0 +1,646 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ListingEngine.h"
+#include "IPKException.h"
+
+struct ListingEngine::ResolverQueue
+{
+    struct Job
+    {
+        uint64_t hostSerial;
+        std::string hostname;
+        uint16_t port;
+        AddressList addresses;
+    };
+
+    ResolverQueue() : threadCount(0), idleThreads(0), stopped(false)
+    {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (eventFd == -1)
+            throw IPKException("ListingEngine::ListingEngine - unable to create resolver event");
+    }
+
+    ~ResolverQueue()
+    {
+        close(eventFd);
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Job> jobs;
+    std::vector<Job> results;
+    uint32_t threadCount;
+    uint32_t idleThreads;
+    bool stopped;
+    int eventFd;            // signaled whenever there are new results
+};
+
+ListingEngine::ListingEngine() : m_timeoutSecs(DEFAULT_TIMEOUT), m_maxActiveHosts(DEFAULT_MAX_ACTIVE_HOSTS),
+    m_listCommand(FTP_CMD_LIST), m_pipelining(false), m_compression(false),
+    m_recvBuffer(ENGINE_RECV_BUFFER_SIZE), m_lastSerial(0), m_resolver(std::make_shared<ResolverQueue>())
+{
+}
+
+ListingEngine::~ListingEngine()
+{
+    // threads still waiting for the resolver are left behind, they only drop their answers once it comes
+    {
+        std::lock_guard<std::mutex> lock(m_resolver->mutex);
+        m_resolver->stopped = true;
+        m_resolver->jobs.clear();
+    }
+
+    m_resolver->condition.notify_all();
+
+    for (Host* host : m_activeHosts)
+    {
+        FinishHost(host, "aborted");
+        delete host;
+    }
+
+    for (Host* host : m_pendingHosts)
+        delete host;
+}
+
+void ListingEngine::AddHost(const std::string& id, const char* hostname, uint16_t port, const char* username,
+    const char* password, const char* dirPath)
+{
+    Host* host = new Host();
+    host->serial = ++m_lastSerial;
+    host->id = id;
+    host->hostname = hostname;
+    host->port = port;
+    host->username = username ? username : "anonymous";
+    host->password = password ? password : "anonymous";
+    host->anonymous = !username;
+    host->dirPath = dirPath;
+    host->state = HOST_STATE_RESOLVING;
+    host->nextAddress = 0;
+    host->controlFd = -1;
+    host->dataFd = -1;
+    host->dataConnected = false;
+    host->dataClosed = false;
+    host->transferResult = 0;
+    host->multilineCode = 0;
+    m_pendingHosts.push_back(host);
+}
+
+void ListingEngine::SetTimeout(uint32_t timeoutSecs)
+{
+    m_timeoutSecs = timeoutSecs;
+}
+
+void ListingEngine::SetMaxActiveHosts(uint32_t maxActiveHosts)
+{
+    if (!maxActiveHosts)
+        throw IPKException("ListingEngine::SetMaxActiveHosts - at least one host must be active");
+
+    m_maxActiveHosts = maxActiveHosts;
+}
+
+void ListingEngine::SetListCommand(FtpCommand listCommand)
+{
+    if (listCommand != FTP_CMD_LIST && listCommand != FTP_CMD_MLSD)
+        throw IPKException("ListingEngine::SetListCommand - invalid listing command");
+
+    m_listCommand = listCommand;
+}
+
+void ListingEngine::SetPipelining(bool pipelining)
+{
+    m_pipelining = pipelining;
+}
+
+void ListingEngine::SetCompression(bool compression)
+{
+    m_compression = compression;
+}
+
+void ListingEngine::Run(const ListingResultCallback& resultCallback)
+{
+    std::vector<pollfd> pollFds;
+    std::vector<Host*> pollHosts;
+    while (!m_pendingHosts.empty() || !m_activeHosts.empty())
+    {
+        while (!m_pendingHosts.empty() && m_activeHosts.size() < m_maxActiveHosts)
+        {
+            Host* host = m_pendingHosts.front();
+            m_pendingHosts.pop_front();
+            m_activeHosts.push_back(host);
+            StartHost(host);
+        }
+
+        // we don't wait past the nearest deadline
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        int64_t pollTimeout = 1000;
+        pollFds.clear();
+        pollHosts.clear();
+
+        // answers of the resolver threads, there is no host for them
+        pollfd pollFd;
+        pollFd.fd = m_resolver->eventFd;
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        pollFds.push_back(pollFd);
+        pollHosts.push_back(nullptr);
+
+        for (Host* host : m_activeHosts)
+        {
+            if (host->state == HOST_STATE_DONE)
+            {
+                pollTimeout = 0;
+                continue;
+            }
+
+            int64_t untilDeadline = std::chrono::duration_cast<std::chrono::milliseconds>(host->deadline - now).count();
+            pollTimeout = std::max<int64_t>(0, std::min(pollTimeout, untilDeadline));
+            if (host->state == HOST_STATE_RESOLVING)
+                continue;
+
+            pollFd.fd = host->controlFd;
+            pollFd.events = (host->state == HOST_STATE_CONNECTING) ? POLLOUT : POLLIN;
+            pollFds.push_back(pollFd);
+            pollHosts.push_back(host);
+
+            if (host->dataFd != -1)
+            {
+                pollFd.fd = host->dataFd;
+                pollFd.events = host->dataConnected ? POLLIN : POLLOUT;
+                pollFds.push_back(pollFd);
+                pollHosts.push_back(host);
+            }
+        }
+
+        int ready = poll(pollFds.data(), pollFds.size(), pollTimeout);
+        if (ready == -1 && errno != EINTR)
+            throw IPKException("ListingEngine::Run - poll failed");
+
+        for (uint32_t i = 0; ready > 0 && i < pollFds.size(); ++i)
+        {
+            Host* host = pollHosts[i];
+            if (!pollFds[i].revents)
+                continue;
+
+            if (!host)
+            {
+                HandleResolved();
+                continue;
+            }
+
+            if (host->state == HOST_STATE_DONE)
+                continue;
+
+            if (pollFds[i].fd == host->controlFd)
+                HandleControl(host, pollFds[i].revents);
+            else if (pollFds[i].fd == host->dataFd)
+                HandleData(host, pollFds[i].revents);
+        }
+
+        now = std::chrono::steady_clock::now();
+        for (auto itr = m_activeHosts.begin(); itr != m_activeHosts.end(); )
+        {
+            Host* host = *itr;
+            if (host->state != HOST_STATE_DONE && now >= host->deadline)
+                FinishHost(host, "connection timed out");
+
+            if (host->state != HOST_STATE_DONE)
+            {
+                ++itr;
+                continue;
+            }
+
+            itr = m_activeHosts.erase(itr);
+            resultCallback(host->id, host->error, host->listing);
+            delete host;
+        }
+    }
+}
+
+void ListingEngine::StartHost(Host* host)
+{
+    host->deadline = std::chrono::steady_clock::now() + std::chrono::seconds(m_timeoutSecs);
+    host->timer = LogTimer();
+
+    ResolverQueue::Job job;
+    job.hostSerial = host->serial;
+    job.hostname = host->hostname;
+    job.port = host->port;
+
+    bool startThread;
+    {
+        std::lock_guard<std::mutex> lock(m_resolver->mutex);
+        m_resolver->jobs.push_back(job);
+        startThread = (m_resolver->jobs.size() > m_resolver->idleThreads && m_resolver->threadCount < ENGINE_RESOLVER_THREADS);
+        if (startThread)
+            m_resolver->threadCount++;
+    }
+
+    if (startThread)
+        std::thread(&ListingEngine::ResolveLoop, m_resolver).detach();
+    else
+        m_resolver->condition.notify_one();
+}
+
+void ListingEngine::ResolveLoop(std::shared_ptr<ResolverQueue> resolver)
+{
+    std::unique_lock<std::mutex> lock(resolver->mutex);
+    while (true)
+    {
+        resolver->idleThreads++;
+        resolver->condition.wait(lock, [&resolver]() { return resolver->stopped || !resolver->jobs.empty(); });
+        resolver->idleThreads--;
+        if (resolver->stopped)
+            return;
+
+        ResolverQueue::Job job = resolver->jobs.front();
+        resolver->jobs.pop_front();
+        lock.unlock();
+
+        // answers are cached, the hosts sharing the server don't wait for the resolver again
+        try
+        {
+            job.addresses = Resolver::Resolve(job.hostname, job.port);
+        }
+        catch (const IPKException&)
+        {
+            // empty list tells the engine that the hostname can't be resolved
+        }
+
+        lock.lock();
+        resolver->results.push_back(job);
+        uint64_t value = 1;
+        ssize_t written = write(resolver->eventFd, &value, sizeof(uint64_t));
+        (void)written;
+    }
+}
+
+void ListingEngine::HandleResolved()
+{
+    uint64_t value;
+    ssize_t bytesRead = read(m_resolver->eventFd, &value, sizeof(uint64_t));
+    (void)bytesRead;
+
+    std::vector<ResolverQueue::Job> results;
+    {
+        std::lock_guard<std::mutex> lock(m_resolver->mutex);
+        results.swap(m_resolver->results);
+    }
+
+    for (ResolverQueue::Job& job : results)
+    {
+        // the host could have timed out in the meantime
+        auto itr = std::find_if(m_activeHosts.begin(), m_activeHosts.end(), [&job](const Host* host)
+            {
+                return host->serial == job.hostSerial;
+            });
+
+        if (itr == m_activeHosts.end() || (*itr)->state != HOST_STATE_RESOLVING)
+            continue;
+
+        Host* host = *itr;
+        if (job.addresses.empty())
+        {
+            FinishHost(host, "cannot resolve hostname");
+            continue;
+        }
+
+        host->addresses.swap(job.addresses);
+        host->state = HOST_STATE_CONNECTING;
+        ConnectNextAddress(host);
+    }
+}
+
+void ListingEngine::ConnectNextAddress(Host* host)
+{
+    if (host->controlFd != -1)
+    {
+        close(host->controlFd);
+        host->controlFd = -1;
+    }
+
+    // the addresses come in the order of preference, the next one is tried whenever the previous one fails
+    while (host->nextAddress < host->addresses.size())
+    {
+        host->controlFd = ConnectNonBlocking(host->addresses[host->nextAddress++]);
+        if (host->controlFd != -1)
+            return;
+    }
+
+    FinishHost(host, "unable to connect to the endpoint");
+}
+
+void ListingEngine::FinishHost(Host* host, const std::string& error)
+{
+    if (host->state == HOST_STATE_DONE)
+        return;
+
+    if (host->controlFd != -1)
+        close(host->controlFd);
+
+    if (host->dataFd != -1)
+        close(host->dataFd);
+
+    host->controlFd = -1;
+    host->dataFd = -1;
+    host->error = error;
+    host->state = HOST_STATE_DONE;
+
+    // all the hosts share the single thread, so the session is set for every record
+    Logger::SetSession(host->serial);
+    if (error.empty())
+        LOG_INFO(m_listCommand, host->listing.length(), host->timer.GetDurationUs(), host->id);
+    else
+        LOG_WARNING(m_listCommand, host->listing.length(), host->timer.GetDurationUs(), host->id + ": " + error);
+}
+
+void ListingEngine::HandleControl(Host* host, short events)
+{
+    if (host->state == HOST_STATE_CONNECTING)
+    {
+        if (!IsConnected(host->controlFd))
+            ConnectNextAddress(host);
+        else
+            host->state = HOST_STATE_GREETING;
+
+        return;
+    }
+
+    // one read per readiness, so the single busy host doesn't starve the others
+    ssize_t bytes = recv(host->controlFd, m_recvBuffer.data(), m_recvBuffer.size(), MSG_DONTWAIT);
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+
+    if (bytes <= 0)
+    {
+        FinishHost(host, (events & POLLERR) ? "connection error" : "connection closed by server");
+        return;
+    }
+
+    const char* data = m_recvBuffer.data();
+    while (bytes > 0 && host->state != HOST_STATE_DONE)
+    {
+        const char* lineEnd = (const char*)memchr(data, '\n', bytes);
+        uint32_t consumed = lineEnd ? (lineEnd - data + 1) : bytes;
+        host->replyLine.append(data, consumed);
+        data += consumed;
+        bytes -= consumed;
+
+        if (!lineEnd)
+            break;
+
+        const std::string& line = host->replyLine;
+        bool hasCode = line.length() >= 4 && isdigit(line[0]) && isdigit(line[1]) && isdigit(line[2]);
+        uint16_t lineCode = hasCode ? ((line[0] - '0') * 100 + (line[1] - '0') * 10 + (line[2] - '0')) : 0;
+
+        // the same rules for multiline replies as in FtpSession::ParseResponse
+        if (hasCode && line[3] == '-' && !host->multilineCode)
+            host->multilineCode = lineCode;
+        else if (hasCode && line[3] == ' ' && (!host->multilineCode || host->multilineCode == lineCode))
+        {
+            host->multilineCode = 0;
+            HandleReply(host, lineCode);
+        }
+
+        host->replyLine.clear();
+    }
+}
+
+void ListingEngine::HandleData(Host* host, short /*events*/)
+{
+    if (!host->dataConnected)
+    {
+        if (!IsConnected(host->dataFd))
+            FinishHost(host, "cannot initiate data connection");
+        else
+            host->dataConnected = true;
+
+        return;
+    }
+
+    ssize_t bytes = recv(host->dataFd, m_recvBuffer.data(), m_recvBuffer.size(), MSG_DONTWAIT);
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+
+    if (bytes < 0)
+    {
+        FinishHost(host, "error while receiving data");
+        return;
+    }
+
+    if (bytes > 0 && host->inflater)
+    {
+        try
+        {
+            host->inflater->Inflate((const uint8_t*)m_recvBuffer.data(), bytes, [host](const char* data, uint32_t length)
+            {
+                host->listing.append(data, length);
+            });
+        }
+        catch (const IPKException&)
+        {
+            FinishHost(host, "corrupted compressed listing");
+        }
+
+        return;
+    }
+
+    if (bytes > 0)
+    {
+        host->listing.append(m_recvBuffer.data(), bytes);
+        return;
+    }
+
+    if (host->inflater && !host->inflater->IsFinished())
+    {
+        FinishHost(host, "compressed listing is incomplete");
+        return;
+    }
+
+    close(host->dataFd);
+    host->dataFd = -1;
+    host->dataClosed = true;
+
+    // both the end of data and the transfer result have to arrive, in any order
+    if (host->transferResult)
+    {
+        SendCommand(host, "QUIT");
+        FinishHost(host, "");
+    }
+}
+
+void ListingEngine::HandleReply(Host* host, uint16_t replyCode)
+{
+    // preliminary replies only tell us to wait for the next one
+    if (replyCode < 200)
+        return;
+
+    switch (host->state)
+    {
+        case HOST_STATE_GREETING:
+            if (replyCode != FTP_RES_READY_TO_LOGIN)
+                break;
+
+            SendCommand(host, "USER " + host->username + (m_pipelining ? "\r\nPASS " + host->password : ""));
+            host->state = HOST_STATE_USER;
+            return;
+        case HOST_STATE_USER:
+        case HOST_STATE_PASS:
+        case HOST_STATE_SKIP_PASS:
+            if (replyCode == FTP_RES_SPECIFY_PASS && host->state == HOST_STATE_USER)
+            {
+                if (!m_pipelining)
+                    SendCommand(host, "PASS " + host->password);
+
+                host->state = HOST_STATE_PASS;
+                return;
+            }
+            else if (replyCode == FTP_RES_LOGIN_SUCCESSFUL && host->state == HOST_STATE_USER && m_pipelining)
+            {
+                // logged in without the password, the reply to PASS which is already on its way is skipped
+                host->state = HOST_STATE_SKIP_PASS;
+                return;
+            }
+            else if (replyCode != FTP_RES_LOGIN_SUCCESSFUL && host->state != HOST_STATE_SKIP_PASS)
+                break;
+
+            // there is no FEAT round trip, the server which doesn't know MODE Z just refuses it
+            if (m_compression)
+            {
+                SendCommand(host, m_pipelining ? "MODE Z\r\nPASV\r\n" + GetListCommand(host) : "MODE Z");
+                host->state = HOST_STATE_MODE;
+                return;
+            }
+
+            SendCommand(host, m_pipelining ? "PASV\r\n" + GetListCommand(host) : "PASV");
+            host->state = HOST_STATE_PASV;
+            return;
+        case HOST_STATE_MODE:
+            if (replyCode == FTP_RES_COMMAND_OK)
+                host->inflater.reset(new Inflater());
+
+            if (!m_pipelining)
+                SendCommand(host, "PASV");
+
+            host->state = HOST_STATE_PASV;
+            return;
+        case HOST_STATE_PASV:
+            if (replyCode != FTP_RES_PASSIVE_MODE)
+                break;
+
+            OpenDataConnection(host);
+            if (host->state == HOST_STATE_DONE)
+                return;
+
+            if (!m_pipelining)
+                SendCommand(host, GetListCommand(host));
+
+            host->state = HOST_STATE_LIST;
+            return;
+        case HOST_STATE_LIST:
+            if (replyCode != FTP_RES_CLOSE_DATA_CONN && replyCode != FTP_RES_FILE_ACTION_OK)
+                break;
+
+            host->transferResult = replyCode;
+            if (host->dataClosed)
+            {
+                SendCommand(host, "QUIT");
+                FinishHost(host, "");
+            }
+            return;
+        default:
+            break;
+    }
+
+    std::string replyLine = host->replyLine;
+    while (!replyLine.empty() && (replyLine[replyLine.length() - 1] == '\n' || replyLine[replyLine.length() - 1] == '\r'))
+        replyLine.erase(replyLine.length() - 1);
+
+    FinishHost(host, "unexpected reply: " + replyLine);
+}
+
+void ListingEngine::SendCommand(Host* host, const std::string& command)
+{
+    // commands are tiny and the socket buffer is empty at that time, so the whole command always fits in
+    std::string line = command + "\r\n";
+    if (send(host->controlFd, line.c_str(), line.length(), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)line.length())
+        FinishHost(host, "unable to send command");
+}
+
+std::string ListingEngine::GetListCommand(Host* host) const
+{
+    return std::string(m_listCommand == FTP_CMD_MLSD ? "MLSD" : "LIST") + (host->dirPath.empty() ? "" : " " + host->dirPath);
+}
+
+void ListingEngine::OpenDataConnection(Host* host)
+{
+    // 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2), some servers leave out the parentheses
+    const char* numbers = host->replyLine.c_str() + 3;
+    while (*numbers && !isdigit(*numbers))
+        numbers++;
+
+    uint32_t h1, h2, h3, h4, p1, p2;
+    if (sscanf(numbers, "%u,%u,%u,%u,%u,%u", &h1, &h2, &h3, &h4, &p1, &p2) != 6 || p1 > 255 || p2 > 255)
+    {
+        FinishHost(host, "malformed passive mode reply");
+        return;
+    }
+
+    if (h1 > 255 || h2 > 255 || h3 > 255 || h4 > 255)
+    {
+        FinishHost(host, "malformed passive mode reply");
+        return;
+    }
+
+    // the address is numeric, there is nothing to resolve which could block the loop
+    ResolvedAddress dataPoint;
+    memset(&dataPoint, 0, sizeof(ResolvedAddress));
+    sockaddr_in* dataAddr = (sockaddr_in*)&dataPoint.address;
+    dataAddr->sin_family = AF_INET;
+    dataAddr->sin_addr.s_addr = htonl((h1 << 24) | (h2 << 16) | (h3 << 8) | h4);
+    dataAddr->sin_port = htons((p1 << 8) | p2);
+    dataPoint.length = sizeof(sockaddr_in);
+    dataPoint.family = AF_INET;
+
+    host->dataFd = ConnectNonBlocking(dataPoint);
+    if (host->dataFd == -1)
+        FinishHost(host, "cannot initiate data connection");
+}
+
+int ListingEngine::ConnectNonBlocking(const ResolvedAddress& remotePoint)
+{
+    int fd = socket(remotePoint.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (const sockaddr*)&remotePoint.address, remotePoint.length) != 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool ListingEngine::IsConnected(int fd)
+{
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    return getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error == 0;
+}
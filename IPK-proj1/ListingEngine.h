@@ -0,0 +1,123 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef LISTING_ENGINE_H
+#define LISTING_ENGINE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include "FtpSession.h"
+#include "Inflater.h"
+#include "Resolver.h"
+#include "Logger.h"
+
+#define DEFAULT_MAX_ACTIVE_HOSTS    256
+#define ENGINE_RECV_BUFFER_SIZE     65536
+#define ENGINE_RESOLVER_THREADS     8
+
+// called once for each host when its listing is done, 'error' is empty on success
+typedef std::function<void(const std::string& id, const std::string& error, const std::string& listing)> ListingResultCallback;
+
+// Lists the directories on many servers at once from the single thread. Every host goes through its own state
+// machine (resolve, connect, login, PASV, LIST) driven by the readiness of its non-blocking sockets. Hostnames are
+// resolved by the helper threads, so the slow resolver doesn't hold up the other hosts.
+class ListingEngine
+{
+public:
+    ListingEngine();
+    ~ListingEngine();
+
+    void AddHost(const std::string& id, const char* hostname, uint16_t port, const char* username, const char* password,
+        const char* dirPath);
+
+    void SetTimeout(uint32_t timeoutSecs);
+    void SetMaxActiveHosts(uint32_t maxActiveHosts);
+    void SetListCommand(FtpCommand listCommand);
+    // login and listing commands are sent in pairs without waiting for the replies in between
+    void SetPipelining(bool pipelining);
+    // listings are requested in MODE Z, hosts which refuse it send them uncompressed
+    void SetCompression(bool compression);
+
+    // runs until all hosts are done, results are reported in the order they complete
+    void Run(const ListingResultCallback& resultCallback);
+
+private:
+    enum HostState
+    {
+        HOST_STATE_RESOLVING    = 0,
+        HOST_STATE_CONNECTING,
+        HOST_STATE_GREETING,
+        HOST_STATE_USER,
+        HOST_STATE_PASS,
+        HOST_STATE_SKIP_PASS,
+        HOST_STATE_MODE,
+        HOST_STATE_PASV,
+        HOST_STATE_LIST,
+        HOST_STATE_DONE
+    };
+
+    struct Host
+    {
+        uint64_t serial;
+        std::string id;
+        std::string hostname;
+        uint16_t port;
+        std::string username;
+        std::string password;
+        bool anonymous;
+        std::string dirPath;
+
+        HostState state;
+        AddressList addresses;
+        size_t nextAddress;
+        int controlFd;
+        int dataFd;
+        bool dataConnected;
+        bool dataClosed;
+        uint16_t transferResult;
+        std::string replyLine;
+        uint16_t multilineCode;
+        std::string listing;
+        std::unique_ptr<Inflater> inflater;
+        std::string error;
+        std::chrono::steady_clock::time_point deadline;
+        LogTimer timer;
+    };
+
+    // shared with the resolver threads, which may outlive the engine while they wait for the slow resolver
+    struct ResolverQueue;
+
+    void StartHost(Host* host);
+    void ConnectNextAddress(Host* host);
+    void HandleResolved();
+    void FinishHost(Host* host, const std::string& error);
+    void HandleControl(Host* host, short events);
+    void HandleData(Host* host, short events);
+    void HandleReply(Host* host, uint16_t replyCode);
+    void SendCommand(Host* host, const std::string& command);
+    void OpenDataConnection(Host* host);
+    std::string GetListCommand(Host* host) const;
+
+    static int ConnectNonBlocking(const ResolvedAddress& remotePoint);
+    static bool IsConnected(int fd);
+    static void ResolveLoop(std::shared_ptr<ResolverQueue> resolver);
+
+    std::deque<Host*> m_pendingHosts;
+    std::vector<Host*> m_activeHosts;
+    uint32_t m_timeoutSecs;
+    uint32_t m_maxActiveHosts;
+    FtpCommand m_listCommand;
+    bool m_pipelining;
+    bool m_compression;
+    std::vector<char> m_recvBuffer;
+    uint64_t m_lastSerial;
+    std::shared_ptr<ResolverQueue> m_resolver;
+};
+
+#endif // LISTING_ENGINE_H
@@ -0,0 +1,222 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <sstream>
+#include <utility>
+#include "SessionPool.h"
+#include "IPKException.h"
+
+SessionPool::SessionPool(uint32_t keepAliveInterval) : m_stopped(false), m_keepAliveInterval(keepAliveInterval), m_pipelining(false),
+    m_compression(false), m_trace(NULL)
+{
+    m_keepAliveThread = std::thread(&SessionPool::KeepAliveLoop, this);
+}
+
+SessionPool::~SessionPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+
+    m_stopCondition.notify_one();
+    m_keepAliveThread.join();
+
+    for (auto& idleList : m_idleSessions)
+    {
+        for (IdleSession& idle : idleList.second)
+            DestroySession(idle.session, true);
+    }
+
+    for (auto& busy : m_busySessions)
+        DestroySession(busy.first, false);
+}
+
+void SessionPool::SetPipelining(bool pipelining)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pipelining = pipelining;
+}
+
+void SessionPool::SetCompression(bool compression)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_compression = compression;
+}
+
+void SessionPool::SetTrace(SessionTrace* trace)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trace = trace;
+}
+
+FtpSession* SessionPool::Acquire(const char* hostname, uint16_t port, const char* username, const char* password)
+{
+    std::string key = MakeKey(hostname, port, username, password);
+    bool pipelining, compression;
+    SessionTrace* trace;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pipelining = m_pipelining;
+        compression = m_compression;
+        trace = m_trace;
+        IdleSessionList& idleList = m_idleSessions[key];
+        while (!idleList.empty())
+        {
+            // the most recently used one is the most likely to be still alive
+            FtpSession* session = idleList.back().session;
+            idleList.pop_back();
+
+            if (!session->IsAlive())
+            {
+                DestroySession(session, false);
+                continue;
+            }
+
+            m_busySessions[session] = key;
+            return session;
+        }
+    }
+
+    FtpSession* session = new FtpSession(hostname, port);
+    try
+    {
+        session->SetPipelining(pipelining);
+        session->SetCompression(compression);
+        session->SetTrace(trace);
+        session->Connect(username, password);
+    }
+    catch (const IPKException&)
+    {
+        delete session;
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_busySessions[session] = key;
+    return session;
+}
+
+void SessionPool::Release(FtpSession* session, bool reusable)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto itr = m_busySessions.find(session);
+    if (itr == m_busySessions.end())
+        throw IPKException("SessionPool::Release - session doesn't belong to the pool");
+
+    std::string key = itr->second;
+    m_busySessions.erase(itr);
+
+    IdleSessionList& idleList = m_idleSessions[key];
+    if (!reusable || idleList.size() >= MAX_IDLE_SESSIONS_PER_KEY)
+    {
+        lock.unlock();
+        DestroySession(session, reusable);
+        return;
+    }
+
+    IdleSession idle;
+    idle.session = session;
+    idle.lastUsed = time(NULL);
+    idleList.push_back(idle);
+}
+
+std::string SessionPool::MakeKey(const char* hostname, uint16_t port, const char* username, const char* password)
+{
+    // session logged in with one password mustn't be handed to the caller with another one, line break can't be
+    // a part of any FTP argument, so the key stays unambiguous
+    std::ostringstream key;
+    key << (username ? username : "anonymous") << '@' << hostname << ':' << port << '\n' << (password ? password : "anonymous");
+    return key.str();
+}
+
+void SessionPool::DestroySession(FtpSession* session, bool disconnect)
+{
+    try
+    {
+        if (disconnect)
+            session->Disconnect();
+    }
+    catch (const IPKException&)
+    {
+        // we are throwing it away anyway
+    }
+
+    delete session;
+}
+
+void SessionPool::KeepAliveLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopped)
+    {
+        m_stopCondition.wait_for(lock, std::chrono::seconds(m_keepAliveInterval));
+        if (m_stopped)
+            break;
+
+        // take out the sessions idle for the whole interval, so the NOOP round trips don't block the others
+        std::vector<std::pair<std::string, FtpSession*>> staleSessions;
+        time_t now = time(NULL);
+        for (auto& idleList : m_idleSessions)
+        {
+            IdleSessionList& sessions = idleList.second;
+            for (auto itr = sessions.begin(); itr != sessions.end(); )
+            {
+                if (now - itr->lastUsed >= (time_t)m_keepAliveInterval)
+                {
+                    staleSessions.push_back(std::make_pair(idleList.first, itr->session));
+                    itr = sessions.erase(itr);
+                }
+                else
+                    ++itr;
+            }
+        }
+
+        if (staleSessions.empty())
+            continue;
+
+        lock.unlock();
+        for (auto itr = staleSessions.begin(); itr != staleSessions.end(); )
+        {
+            try
+            {
+                itr->second->KeepAlive();
+                ++itr;
+            }
+            catch (const IPKException&)
+            {
+                DestroySession(itr->second, false);
+                itr = staleSessions.erase(itr);
+            }
+        }
+        lock.lock();
+
+        now = time(NULL);
+        std::vector<FtpSession*> excessSessions;
+        for (auto& stale : staleSessions)
+        {
+            IdleSessionList& idleList = m_idleSessions[stale.first];
+            if (idleList.size() >= MAX_IDLE_SESSIONS_PER_KEY)
+            {
+                excessSessions.push_back(stale.second);
+                continue;
+            }
+
+            IdleSession idle;
+            idle.session = stale.second;
+            idle.lastUsed = now;
+            idleList.insert(idleList.begin(), idle);
+        }
+
+        // QUIT round trips mustn't block Acquire() and Release() either
+        if (!excessSessions.empty())
+        {
+            lock.unlock();
+            for (FtpSession* session : excessSessions)
+                DestroySession(session, true);
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "FtpSession.h"
+
+#define DEFAULT_KEEPALIVE_INTERVAL  30
+#define MAX_IDLE_SESSIONS_PER_KEY   4
+
+// Keeps logged-in control connections open between the operations, so repeated requests to the same server
+// don't pay for the TCP connect and login again. Idle connections are kept alive by NOOP.
+class SessionPool
+{
+public:
+    SessionPool(uint32_t keepAliveInterval = DEFAULT_KEEPALIVE_INTERVAL);
+    ~SessionPool();
+
+    // applies to the sessions created from now on
+    void SetPipelining(bool pipelining);
+    void SetCompression(bool compression);
+    // sessions record their phases into 'trace'
+    void SetTrace(SessionTrace* trace);
+
+    // returns logged-in session, either idle one from the pool or the new one
+    FtpSession* Acquire(const char* hostname, uint16_t port, const char* username = NULL, const char* password = NULL);
+    // session which failed in the middle of the operation is not in the known state, so it can't be reused
+    void Release(FtpSession* session, bool reusable = true);
+
+private:
+    struct IdleSession
+    {
+        FtpSession* session;
+        time_t lastUsed;
+    };
+
+    typedef std::vector<IdleSession> IdleSessionList;
+
+    static std::string MakeKey(const char* hostname, uint16_t port, const char* username, const char* password);
+    static void DestroySession(FtpSession* session, bool disconnect);
+
+    void KeepAliveLoop();
+
+    std::map<std::string, IdleSessionList> m_idleSessions;
+    std::map<FtpSession*, std::string> m_busySessions;
+    std::mutex m_mutex;
+    std::condition_variable m_stopCondition;
+    bool m_stopped;
+    uint32_t m_keepAliveInterval;
+    bool m_pipelining;
+    bool m_compression;
+    SessionTrace* m_trace;
+    std::thread m_keepAliveThread;
+};
+
+#endif // SESSION_POOL_H
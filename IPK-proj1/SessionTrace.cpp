@@ -0,0 +1,91 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#include <exception>
+#include <algorithm>
+#include "SessionTrace.h"
+#include "Socket.h"
+
+SessionTrace::SessionTrace() : m_origin(std::chrono::steady_clock::now()), m_sessionCount(0)
+{
+}
+
+uint32_t SessionTrace::NewSessionId()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sessionCount++;
+}
+
+void SessionTrace::AddPhase(uint32_t sessionId, const char* phase, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end, uint64_t bytesSent, uint64_t bytesReceived, bool failed)
+{
+    Phase record;
+    record.sessionId = sessionId;
+    record.name = phase;
+    record.startUsecs = std::chrono::duration_cast<std::chrono::microseconds>(start - m_origin).count();
+    record.durationUsecs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    record.bytesSent = bytesSent;
+    record.bytesReceived = bytesReceived;
+    record.failed = failed;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phases.push_back(record);
+}
+
+void SessionTrace::WriteJson(FILE* output) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // phases are recorded when they end, the timeline is ordered by their beginning
+    std::vector<const Phase*> timeline;
+    for (const Phase& phase : m_phases)
+        timeline.push_back(&phase);
+
+    std::stable_sort(timeline.begin(), timeline.end(), [](const Phase* first, const Phase* second)
+    {
+        return first->startUsecs < second->startUsecs;
+    });
+
+    fprintf(output, "{\"sessions\":%u,\"phases\":[", m_sessionCount);
+    for (size_t i = 0; i < timeline.size(); ++i)
+    {
+        const Phase* phase = timeline[i];
+        fprintf(output, "%s\n{\"session\":%u,\"phase\":\"%s\",\"start_us\":%lld,\"duration_us\":%lld,\"bytes_sent\":%llu,"
+            "\"bytes_received\":%llu,\"failed\":%s}", i ? "," : "", phase->sessionId, phase->name, (long long)phase->startUsecs,
+            (long long)phase->durationUsecs, (unsigned long long)phase->bytesSent, (unsigned long long)phase->bytesReceived,
+            phase->failed ? "true" : "false");
+    }
+
+    fprintf(output, "\n]}\n");
+}
+
+TracePhase::TracePhase(SessionTrace* trace, uint32_t sessionId, const char* phase, const Socket* socket) : m_trace(trace),
+    m_sessionId(sessionId), m_phase(phase), m_socket(socket), m_startBytesSent(0), m_startBytesReceived(0), m_extraBytesReceived(0)
+{
+    if (!m_trace)
+        return;
+
+    m_start = std::chrono::steady_clock::now();
+    if (m_socket)
+    {
+        m_startBytesSent = m_socket->GetBytesSent();
+        m_startBytesReceived = m_socket->GetBytesReceived();
+    }
+}
+
+TracePhase::~TracePhase()
+{
+    if (!m_trace)
+        return;
+
+    uint64_t bytesSent = m_socket ? m_socket->GetBytesSent() - m_startBytesSent : 0;
+    uint64_t bytesReceived = (m_socket ? m_socket->GetBytesReceived() - m_startBytesReceived : 0) + m_extraBytesReceived;
+    m_trace->AddPhase(m_sessionId, m_phase, m_start, std::chrono::steady_clock::now(), bytesSent, bytesReceived,
+        std::uncaught_exception());
+}
+
+void TracePhase::AddBytesReceived(uint64_t bytes)
+{
+    m_extraBytesReceived += bytes;
+}
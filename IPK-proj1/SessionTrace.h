@@ -0,0 +1,73 @@
+/**
+ * Project: IPK - Project 1 (2014) - FTP client
+ * Author: Marek Milkovic <xmilko01@stud.fit.vutbr.cz>
+ **/
+#ifndef SESSION_TRACE_H
+#define SESSION_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+class Socket;
+
+// Timeline of the phases (resolving, connecting, login, PASV, transfer...) of all sessions sharing it. Sessions can
+// run in different threads.
+class SessionTrace
+{
+public:
+    SessionTrace();
+
+    // every traced session gets its own number
+    uint32_t NewSessionId();
+    void AddPhase(uint32_t sessionId, const char* phase, std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end, uint64_t bytesSent, uint64_t bytesReceived, bool failed);
+
+    void WriteJson(FILE* output) const;
+
+private:
+    struct Phase
+    {
+        uint32_t sessionId;
+        const char* name;
+        int64_t startUsecs;
+        int64_t durationUsecs;
+        uint64_t bytesSent;
+        uint64_t bytesReceived;
+        bool failed;
+    };
+
+    std::chrono::steady_clock::time_point m_origin;
+    std::vector<Phase> m_phases;
+    uint32_t m_sessionCount;
+    mutable std::mutex m_mutex;
+};
+
+// Measures one phase from its construction to its destruction, together with the bytes which went through the socket
+// in the meantime. Phase left by the exception is marked as failed. Does nothing without the trace.
+class TracePhase
+{
+public:
+    TracePhase(SessionTrace* trace, uint32_t sessionId, const char* phase, const Socket* socket = NULL);
+    ~TracePhase();
+
+    // data which didn't pass through the socket buffer (spliced right into the file)
+    void AddBytesReceived(uint64_t bytes);
+
+private:
+    TracePhase(const TracePhase&);
+    TracePhase& operator=(const TracePhase&);
+
+    SessionTrace* m_trace;
+    uint32_t m_sessionId;
+    const char* m_phase;
+    const Socket* m_socket;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_startBytesSent;
+    uint64_t m_startBytesReceived;
+    uint64_t m_extraBytesReceived;
+};
+
+#endif // SESSION_TRACE_H
@@ -6,16 +6,71 @@
 #include <sstream>
 #include <iomanip>
 #include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <cstdlib>
+#include <cctype>
 #include "FtpSession.h"
+#include "FtpDownloader.h"
+#include "SessionPool.h"
+#include "FtpCrawler.h"
+#include "ListingEngine.h"
+#include "ListingCache.h"
+#include "SessionTrace.h"
+#include "DirListing.h"
+#include "Logger.h"
 #include "IPKException.h"
-#include "Regex.h"
 
-#define MATCH_USERPASS      2
-#define MATCH_USERNAME      3
-#define MATCH_PASSWORD      4
-#define MATCH_HOST          5
-#define MATCH_PORT          7
-#define MATCH_PATH          8
+#define OUTPUT_BUFFER_SIZE  (1 << 20)
+#define LISTING_BATCH_SIZE  4096
+
+struct FtpUrl
+{
+    std::string hostname;
+    uint16_t port;
+    std::string username;
+    std::string password;
+    bool anonymous;
+    std::string path;
+};
+
+// writes out the log on every way out of main, nothing happens if it wasn't started
+class LogFile
+{
+public:
+    ~LogFile()
+    {
+        Logger::Stop();
+    }
+};
+
+// writes the timeline of the sessions when the client is done with them, failed run included
+class TraceFile
+{
+public:
+    TraceFile(const char* path) : m_path(path) { }
+
+    ~TraceFile()
+    {
+        FILE* output = (m_path == "-") ? stderr : fopen(m_path.c_str(), "w");
+        if (!output)
+            return;
+
+        m_trace.WriteJson(output);
+        if (output != stderr)
+            fclose(output);
+    }
+
+    SessionTrace* GetTrace()
+    {
+        return &m_trace;
+    }
+
+private:
+    std::string m_path;
+    SessionTrace m_trace;
+};
 
 void printHelpClause(const char* left, const char* right)
 {
@@ -30,69 +85,553 @@ void printHelp()
     std::cout << std::endl;
     std::cout << "Usage:" << std::endl;
 
-    const char* usage = "ftpclient --help | URL";
+    const char* usage = "ftpclient --help | [--pipeline] [--compress] [--trace FILE] [--log FILE] [--cache DIR [--cache-ttl SECS]] [--mlsd] [--tsv | --json] (URL | --batch [URL] | --recursive [--depth N] [--sessions N] URL | --hosts FILE [--sessions N] [--timeout SECS]) | [--pipeline] [--compress] [--trace FILE] [--log FILE] --get FILE [--parallel N] [--resume] URL";
     std::cout << std::setw(10 + strlen(usage)) << std::setfill(' ') << usage << std::endl;
     std::cout << std::endl;
     printHelpClause("--help", "Prints help");
+    printHelpClause("--pipeline", "Sends the commands ahead of the replies where possible, saves the round trips on slow links");
+    printHelpClause("--compress", "Transfers the data compressed (MODE Z) if the server supports it");
+    printHelpClause("--trace", "Writes the timeline of the session phases as JSON into FILE (- for stderr)");
+    printHelpClause("--log", "Appends the records of the sessions, listings and downloads into FILE (- for stderr)");
+    printHelpClause("--mlsd", "Lists the directory with MLSD instead of LIST");
+    printHelpClause("--tsv", "Prints parsed entries as tab separated name, type, size, mtime and perms");
+    printHelpClause("--json", "Prints parsed entries as JSON array");
+    printHelpClause("--batch", "Lists every URL read from stdin (one per line) over the reused connections, lines starting with / are paths on URL");
+    printHelpClause("--recursive", "Lists the whole directory tree at URL, entries are printed with their full paths");
+    printHelpClause("--depth", "Lists at most N levels of subdirectories in recursive mode");
+    printHelpClause("--sessions", "Number of concurrent connections used in recursive and multi-host mode");
+    printHelpClause("--hosts", "Lists every URL from FILE (one per line) concurrently, results are printed as they complete");
+    printHelpClause("--timeout", "Time limit for each host in multi-host mode");
+    printHelpClause("--cache", "Keeps the listings in DIR, fresh ones are printed without asking the server");
+    printHelpClause("--cache-ttl", "Cached listing younger than SECS is fresh, older one is listed again only if the directory changed");
+    printHelpClause("--get", "Downloads the file at URL in binary mode into the local FILE");
+    printHelpClause("--parallel", "Splits the download into N byte ranges fetched over separate connections");
+    printHelpClause("--resume", "Continues the download from the current size of the local FILE");
     printHelpClause("URL", "URL of the FTP server in format [ftp://[username:password@]]hostname[:port][/path][/]");
 }
 
+// hostname[:port][/path][/] part of the URL
+bool parseUrlAddress(const char* pos, FtpUrl& ftpUrl)
+{
+    const char* hostEnd = pos;
+    while (isalnum(*hostEnd) || *hostEnd == '.' || *hostEnd == '-')
+        hostEnd++;
+
+    if (hostEnd == pos)
+        return false;
+
+    ftpUrl.hostname.assign(pos, hostEnd);
+    pos = hostEnd;
+
+    ftpUrl.port = DEFAULT_FTP_PORT;
+    if (*pos == ':')
+    {
+        uint32_t port = 0;
+        const char* portStart = ++pos;
+        while (isdigit(*pos) && port <= UINT16_MAX)
+            port = port * 10 + (*pos++ - '0');
+
+        if (pos == portStart || port > UINT16_MAX)
+            return false;
+
+        ftpUrl.port = port;
+    }
+
+    // path is made of non-empty components, only the last slash can stand alone
+    const char* pathStart = pos;
+    while (*pos == '/')
+    {
+        const char* componentEnd = pos + 1;
+        while (*componentEnd && *componentEnd != '/' && !isspace(*componentEnd))
+            componentEnd++;
+
+        bool lastSlash = (componentEnd == pos + 1);
+        pos = componentEnd;
+        if (lastSlash)
+            break;
+    }
+
+    if (*pos)
+        return false;
+
+    ftpUrl.path.assign(pathStart, pos);
+    return true;
+}
+
+// hand-written for [ftp://[username:password@]]hostname[:port][/path][/], it is called for every line in batch mode
+bool parseUrl(const char* url, FtpUrl& ftpUrl)
+{
+    // default are anonymous credentials, they can be given only together with the scheme
+    ftpUrl.anonymous = true;
+    if (strncmp(url, "ftp://", 6) != 0)
+        return parseUrlAddress(url, ftpUrl);
+
+    const char* userStart = url + 6;
+    const char* userEnd = userStart;
+    while (*userEnd && !isspace(*userEnd) && *userEnd != '@' && *userEnd != ':')
+        userEnd++;
+
+    const char* passEnd = userEnd;
+    if (*userEnd == ':')
+    {
+        passEnd = userEnd + 1;
+        while (*passEnd && !isspace(*passEnd) && *passEnd != '@' && *passEnd != ':')
+            passEnd++;
+    }
+
+    // what looks like credentials can be the part of the path as well, it is credentials only if the rest is valid
+    if (*userEnd == ':' && *passEnd == '@' && parseUrlAddress(passEnd + 1, ftpUrl))
+    {
+        // empty username and password both at once are an error
+        if (userEnd == userStart && passEnd == userEnd + 1)
+            return false;
+
+        ftpUrl.anonymous = false;
+        ftpUrl.username.assign(userStart, userEnd);
+        ftpUrl.password.assign(userEnd + 1, passEnd);
+        return true;
+    }
+
+    return parseUrlAddress(userStart, ftpUrl);
+}
+
+// 'getSession' is called only when the listing can't be served from the cache
+void listDirectory(const FtpUrl& url, const std::function<FtpSession*()>& getSession, FtpCommand listCommand, ListFormat format,
+    const ListingCache* cache, uint32_t cacheTtl)
+{
+    auto fetchListing = [&](const ListLineCallback& lineCallback)
+    {
+        if (cache)
+        {
+            std::string key = ListingCache::MakeKey(url.hostname, url.port, url.anonymous ? "" : url.username, listCommand, url.path);
+            cache->FetchListing(key, url.path, listCommand, cacheTtl, getSession, lineCallback);
+        }
+        else
+            getSession()->ListDir(url.path.c_str(), lineCallback, listCommand);
+    };
+
+    if (format == LIST_FORMAT_RAW)
+    {
+        fetchListing([](const char* line, uint32_t length)
+        {
+            fwrite(line, 1, length, stdout);
+        });
+        return;
+    }
+
+    // entries are parsed into the table and written out in batches, so the memory stays bounded
+    DirListing listing;
+    bool firstBatch = true;
+    auto writeBatch = [&]()
+    {
+        if (format == LIST_FORMAT_TSV)
+            listing.WriteTsv(stdout);
+        else
+        {
+            if (firstBatch)
+                fputs("[", stdout);
+
+            listing.WriteJson(stdout, firstBatch);
+        }
+
+        firstBatch = false;
+        listing.Clear();
+    };
+
+    fetchListing([&](const char* line, uint32_t length)
+    {
+        if (listCommand == FTP_CMD_MLSD)
+            listing.ParseMlsdLine(line, length);
+        else
+            listing.ParseListLine(line, length);
+
+        if (listing.GetEntryCount() == LISTING_BATCH_SIZE)
+            writeBatch();
+    });
+
+    writeBatch();
+    if (format == LIST_FORMAT_JSON)
+        fputs("\n]\n", stdout);
+}
+
+// lists the whole tree, returns the number of directories which couldn't be listed
+uint32_t listRecursive(const FtpUrl& url, FtpCommand listCommand, ListFormat format, uint32_t sessionCount, uint32_t maxDepth,
+    bool pipelining, bool compression, SessionTrace* trace, const ListingCache* cache, uint32_t cacheTtl)
+{
+    FtpCrawler crawler(url.hostname.c_str(), url.port, url.anonymous ? NULL : url.username.c_str(), url.anonymous ? NULL : url.password.c_str());
+    crawler.SetSessionCount(sessionCount);
+    crawler.SetMaxDepth(maxDepth);
+    crawler.SetListCommand(listCommand);
+    crawler.SetPipelining(pipelining);
+    crawler.SetCompression(compression);
+    crawler.SetTrace(trace);
+    crawler.SetCache(cache, cacheTtl);
+
+    bool firstBatch = true;
+    crawler.Crawl(url.path.c_str(), [&](const std::string&, const DirListing& listing)
+    {
+        if (format == LIST_FORMAT_RAW)
+            listing.WriteNames(stdout);
+        else if (format == LIST_FORMAT_TSV)
+            listing.WriteTsv(stdout);
+        else if (listing.GetEntryCount())
+        {
+            if (firstBatch)
+                fputs("[", stdout);
+
+            listing.WriteJson(stdout, firstBatch);
+            firstBatch = false;
+        }
+    });
+
+    if (format == LIST_FORMAT_JSON)
+        fputs(firstBatch ? "[]\n" : "\n]\n", stdout);
+
+    fflush(stdout);
+    for (const std::string& dirPath : crawler.GetFailedDirs())
+        std::cerr << dirPath << ": unable to list the directory" << std::endl;
+
+    return crawler.GetFailedDirs().size();
+}
+
+// lists all URLs from the file at once, returns the number of failed ones
+uint32_t listHosts(const char* hostsFile, FtpCommand listCommand, ListFormat format, uint32_t maxActiveHosts, uint32_t timeoutSecs,
+    bool pipelining, bool compression)
+{
+    std::ifstream hosts(hostsFile);
+    if (!hosts)
+        throw IPKException("Unable to open the file with URLs");
+
+    ListingEngine engine;
+    engine.SetListCommand(listCommand);
+    engine.SetPipelining(pipelining);
+    engine.SetCompression(compression);
+    engine.SetMaxActiveHosts(maxActiveHosts);
+    engine.SetTimeout(timeoutSecs);
+
+    uint32_t failed = 0;
+    std::string line;
+    while (std::getline(hosts, line))
+    {
+        if (!line.empty() && line[line.length() - 1] == '\r')
+            line.erase(line.length() - 1);
+
+        if (line.empty())
+            continue;
+
+        FtpUrl url;
+        if (!parseUrl(line.c_str(), url))
+        {
+            std::cerr << line << ": Invalid URL format specified" << std::endl;
+            ++failed;
+            continue;
+        }
+
+        engine.AddHost(line, url.hostname.c_str(), url.port, url.anonymous ? NULL : url.username.c_str(),
+            url.anonymous ? NULL : url.password.c_str(), url.path.c_str());
+    }
+
+    // raw listings are written under the URL header, parsed entries get the URL in front of their names
+    DirListing listing;
+    bool firstBatch = true;
+    engine.Run([&](const std::string& id, const std::string& error, const std::string& rawListing)
+    {
+        if (!error.empty())
+        {
+            fflush(stdout);
+            std::cerr << id << ": " << error << std::endl;
+            ++failed;
+            return;
+        }
+
+        if (format == LIST_FORMAT_RAW)
+        {
+            fprintf(stdout, "%s:\n", id.c_str());
+            fwrite(rawListing.c_str(), 1, rawListing.length(), stdout);
+            fputs("\n", stdout);
+            return;
+        }
+
+        listing.Clear();
+        listing.SetNamePrefix(id[id.length() - 1] == '/' ? id : id + '/');
+        const char* lineStart = rawListing.c_str();
+        const char* listingEnd = lineStart + rawListing.length();
+        while (lineStart < listingEnd)
+        {
+            const char* lineEnd = (const char*)memchr(lineStart, '\n', listingEnd - lineStart);
+            uint32_t length = (lineEnd ? lineEnd + 1 : listingEnd) - lineStart;
+            if (listCommand == FTP_CMD_MLSD)
+                listing.ParseMlsdLine(lineStart, length);
+            else
+                listing.ParseListLine(lineStart, length);
+
+            lineStart += length;
+        }
+
+        if (format == LIST_FORMAT_TSV)
+            listing.WriteTsv(stdout);
+        else if (listing.GetEntryCount())
+        {
+            if (firstBatch)
+                fputs("[", stdout);
+
+            listing.WriteJson(stdout, firstBatch);
+            firstBatch = false;
+        }
+
+        // results are meant to be watched as they come
+        fflush(stdout);
+    });
+
+    if (format == LIST_FORMAT_JSON)
+        fputs(firstBatch ? "[]\n" : "\n]\n", stdout);
+
+    fflush(stdout);
+    return failed;
+}
+
+// lists each URL read from stdin, connections to the same server are reused, returns the number of failed ones
+uint32_t listBatch(const FtpUrl* baseUrl, FtpCommand listCommand, ListFormat format, bool pipelining, bool compression,
+    SessionTrace* trace, const ListingCache* cache, uint32_t cacheTtl)
+{
+    SessionPool pool;
+    pool.SetPipelining(pipelining);
+    pool.SetCompression(compression);
+    pool.SetTrace(trace);
+    uint32_t failed = 0;
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        if (!line.empty() && line[line.length() - 1] == '\r')
+            line.erase(line.length() - 1);
+
+        if (line.empty())
+            continue;
+
+        FtpUrl url;
+        if (line[0] == '/' && baseUrl)
+        {
+            url = *baseUrl;
+            url.path = line;
+        }
+        else if (!parseUrl(line.c_str(), url))
+        {
+            std::cerr << line << ": Invalid URL format specified" << std::endl;
+            ++failed;
+            continue;
+        }
+
+        FtpSession* session = NULL;
+        try
+        {
+            listDirectory(url, [&]()
+            {
+                if (!session)
+                {
+                    session = pool.Acquire(url.hostname.c_str(), url.port, url.anonymous ? NULL : url.username.c_str(),
+                        url.anonymous ? NULL : url.password.c_str());
+                }
+
+                return session;
+            }, listCommand, format, cache, cacheTtl);
+
+            if (session)
+                pool.Release(session);
+        }
+        catch (const IPKException& ex)
+        {
+            if (session)
+                pool.Release(session, false);
+
+            fflush(stdout);
+            LOG_ERROR(0, 0, 0, line + ": " + ex.what());
+            std::cerr << line << ": " << ex.what() << std::endl;
+            ++failed;
+        }
+    }
+
+    fflush(stdout);
+    return failed;
+}
+
+
 int main(int argc, char** argv)
 {
+    LogFile logFile;
     try
     {
-        // only one parameter allowed
-        if (argc != 2)
+        // options first, URL is always the last parameter
+        if (argc < 2)
             throw IPKException("Invalid parameters");
 
-        if (strcmp(argv[1], "--help") == 0)
+        FtpCommand listCommand = FTP_CMD_LIST;
+        ListFormat format = LIST_FORMAT_RAW;
+        const char* localFile = NULL;
+        uint32_t segmentCount = 1;
+        bool resume = false;
+        bool batch = false;
+        bool recursive = false;
+        uint32_t sessionCount = 1;
+        uint32_t maxDepth = UNLIMITED_DEPTH;
+        const char* hostsFile = NULL;
+        uint32_t timeoutSecs = DEFAULT_TIMEOUT;
+        bool sessionsSet = false;
+        bool pipelining = false;
+        bool compression = false;
+        const char* cacheDir = NULL;
+        const char* tracePath = NULL;
+        const char* logPath = NULL;
+        uint32_t cacheTtl = DEFAULT_CACHE_TTL;
+        const char* urlParam = NULL;
+        for (int i = 1; i < argc; ++i)
         {
-            printHelp();
-            return 0;
+            if (strcmp(argv[i], "--help") == 0)
+            {
+                printHelp();
+                return 0;
+            }
+            else if (i == argc - 1 && strncmp(argv[i], "--", 2) != 0)
+                urlParam = argv[i];
+            else if (strcmp(argv[i], "--mlsd") == 0)
+                listCommand = FTP_CMD_MLSD;
+            else if (strcmp(argv[i], "--tsv") == 0)
+                format = LIST_FORMAT_TSV;
+            else if (strcmp(argv[i], "--json") == 0)
+                format = LIST_FORMAT_JSON;
+            else if (strcmp(argv[i], "--batch") == 0)
+                batch = true;
+            else if (strcmp(argv[i], "--get") == 0 && i + 1 < argc - 1)
+                localFile = argv[++i];
+            else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc - 1)
+            {
+                std::istringstream iss(argv[++i]);
+                if (!(iss >> segmentCount))
+                    throw IPKException("Invalid parameters");
+            }
+            else if (strcmp(argv[i], "--resume") == 0)
+                resume = true;
+            else if (strcmp(argv[i], "--pipeline") == 0)
+                pipelining = true;
+            else if (strcmp(argv[i], "--compress") == 0)
+                compression = true;
+            else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+                tracePath = argv[++i];
+            else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc)
+                logPath = argv[++i];
+            else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+                cacheDir = argv[++i];
+            else if (strcmp(argv[i], "--cache-ttl") == 0 && i + 1 < argc)
+            {
+                std::istringstream iss(argv[++i]);
+                if (!(iss >> cacheTtl))
+                    throw IPKException("Invalid parameters");
+            }
+            else if (strcmp(argv[i], "--recursive") == 0)
+                recursive = true;
+            else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc - 1)
+            {
+                std::istringstream iss(argv[++i]);
+                if (!(iss >> maxDepth))
+                    throw IPKException("Invalid parameters");
+            }
+            else if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc - 1)
+            {
+                std::istringstream iss(argv[++i]);
+                if (!(iss >> sessionCount))
+                    throw IPKException("Invalid parameters");
+
+                sessionsSet = true;
+            }
+            else if (strcmp(argv[i], "--hosts") == 0 && i + 1 < argc)
+                hostsFile = argv[++i];
+            else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+            {
+                std::istringstream iss(argv[++i]);
+                if (!(iss >> timeoutSecs))
+                    throw IPKException("Invalid parameters");
+            }
+            else
+                throw IPKException("Invalid parameters");
         }
 
-        // magic regular expressions for parsing the URL
-        // DON'T TOUCH IT!!!
-        std::string pattern = R"(^(ftp://(([^[:space:]@:]*):([^[:space:]@:]*)@)?)?([a-zA-Z0-9.-]+)(:([0-9]+))?((/[^/[:space:]]+)*(/?))$)";
-        Regex regex(pattern.c_str());
-        MatchList matches;
-        if (!regex.Match(argv[1], 10, matches))
-            throw IPKException("Invalid URL format specified");
+        if (logPath)
+            Logger::Start(logPath, false);
 
-        // default are anonymous credentials
-        const char* username = NULL, *password = NULL;
-        if (matches[MATCH_USERPASS] == ":@") // is this error? (empty username and password specified)
+        // print the directory lists as they arrive, stdout is fully buffered so we write it in large blocks
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+        if (hostsFile)
         {
-            throw IPKException("Invalid URL format specified");
+            if (urlParam || batch || recursive || localFile || tracePath)
+                throw IPKException("Invalid parameters");
+
+            return listHosts(hostsFile, listCommand, format, sessionsSet ? sessionCount : DEFAULT_MAX_ACTIVE_HOSTS, timeoutSecs,
+                pipelining, compression) ? 1 : 0;
         }
-        else if (matches[MATCH_USERPASS] != "") // any username or password specified
+
+        if (!urlParam && (!batch || localFile || recursive))
+            throw IPKException("Invalid parameters");
+
+        FtpUrl url;
+        if (urlParam && !parseUrl(urlParam, url))
+            throw IPKException("Invalid URL format specified");
+
+        std::unique_ptr<ListingCache> cache;
+        if (cacheDir)
+            cache.reset(new ListingCache(cacheDir));
+
+        std::unique_ptr<TraceFile> traceFile;
+        if (tracePath)
+            traceFile.reset(new TraceFile(tracePath));
+
+        SessionTrace* trace = traceFile ? traceFile->GetTrace() : NULL;
+        if (batch)
+            return listBatch(urlParam ? &url : NULL, listCommand, format, pipelining, compression, trace, cache.get(), cacheTtl) ? 1 : 0;
+
+        if (recursive)
         {
-            username = matches[MATCH_USERNAME].c_str();
-            password = matches[MATCH_PASSWORD].c_str();
+            return listRecursive(url, listCommand, format, sessionCount, maxDepth, pipelining, compression, trace, cache.get(),
+                cacheTtl) ? 1 : 0;
         }
 
-        uint16_t portNum = DEFAULT_FTP_PORT;
-        if (matches[MATCH_PORT] != "")
+        const char* username = url.anonymous ? NULL : url.username.c_str();
+        const char* password = url.anonymous ? NULL : url.password.c_str();
+        if (localFile)
         {
-            // parse out the number from port string
-            std::istringstream iss(matches[MATCH_PORT]);
-            iss >> portNum;
+            FtpDownloader downloader(url.hostname.c_str(), url.port, username, password);
+            downloader.SetSegmentCount(segmentCount);
+            downloader.SetPipelining(pipelining);
+            downloader.SetCompression(compression);
+            downloader.SetTrace(trace);
+            downloader.SetResume(resume);
+            downloader.Download(url.path.c_str(), localFile);
+            return 0;
         }
 
-        // initiate connection
-        FtpSession session(matches[MATCH_HOST].c_str(), portNum);
-        session.Connect(username, password);
+        // initiate connection, fresh cached listing doesn't need any
+        std::unique_ptr<FtpSession> session;
+        listDirectory(url, [&]()
+        {
+            if (!session)
+            {
+                session.reset(new FtpSession(url.hostname.c_str(), url.port));
+                session->SetPipelining(pipelining);
+                session->SetCompression(compression);
+                session->SetTrace(trace);
+                session->Connect(username, password);
+            }
 
-        // print the directory list
-        std::string dir;
-        session.ListDir(matches[MATCH_PATH].c_str(), dir);
-        std::cout << dir;
+            return session.get();
+        }, listCommand, format, cache.get(), cacheTtl);
+        fflush(stdout);
 
         // disconnect
-        session.Disconnect();
+        if (session)
+            session->Disconnect();
     }
     catch (const IPKException& ex)
     {
+        fflush(stdout);
+        LOG_ERROR(0, 0, 0, ex.what());
         std::cerr << ex.what() << std::endl;
         return 1;
     }
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include "BandwidthScheduler.h"
+#include "IPKException.h"
+
+static const uint64_t PriorityWeights[MAX_PRIORITY] =
+{
+    4,  // PRIORITY_DEFAULT
+    8,  // PRIORITY_INTERACTIVE
+    4,  // PRIORITY_NORMAL
+    1   // PRIORITY_BULK
+};
+
+PriorityClass ParsePriorityClass(const std::string& name)
+{
+    if (name == "interactive")
+        return PRIORITY_INTERACTIVE;
+    else if (name == "normal")
+        return PRIORITY_NORMAL;
+    else if (name == "bulk")
+        return PRIORITY_BULK;
+
+    throw IPKException("ParsePriorityClass - unknown priority class " + name);
+}
+
+BandwidthScheduler::BandwidthScheduler(uint64_t rateLimit) : m_rateLimit(rateLimit), m_tokens(0), m_virtualTime(0), m_lastRefill(Clock::now()), m_nextFlowId(0)
+{
+    m_burst = std::max<uint64_t>(m_rateLimit * SCHEDULER_BURST_TIME / 1000, SCHEDULER_MIN_BURST);
+}
+
+BandwidthScheduler::~BandwidthScheduler() { }
+
+uint32_t BandwidthScheduler::RegisterFlow(PriorityClass priority)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Flow flow;
+    flow.priority = priority;
+    flow.finishTag = m_virtualTime;
+    flow.requested = 0;
+    flow.granted = false;
+
+    uint32_t flowId = m_nextFlowId++;
+    m_flows[flowId] = flow;
+    return flowId;
+}
+
+void BandwidthScheduler::UnregisterFlow(uint32_t flowId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_flows.erase(flowId);
+}
+
+void BandwidthScheduler::SetFlowPriority(uint32_t flowId, PriorityClass priority)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto itr = m_flows.find(flowId);
+    if (itr != m_flows.end())
+        itr->second.priority = priority;
+}
+
+uint64_t BandwidthScheduler::Acquire(uint32_t flowId, uint64_t bytes)
+{
+    // no uplink limit, nothing to share
+    if (!m_rateLimit || !bytes)
+        return bytes;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto itr = m_flows.find(flowId);
+    if (itr == m_flows.end())
+        throw IPKException("BandwidthScheduler::Acquire - unknown flow");
+
+    // flow which was idle for some time starts at the current virtual time, so it can't save up the credit
+    Flow& flow = itr->second;
+    flow.requested = std::min(bytes, m_burst);
+    flow.granted = false;
+    flow.finishTag = std::max(flow.finishTag, m_virtualTime) + flow.requested * SCHEDULER_WEIGHT_SCALE / PriorityWeights[flow.priority];
+    m_pendingFlows.insert(std::make_pair(flow.finishTag, flowId));
+
+    while (true)
+    {
+        Refill();
+        Dispatch();
+
+        if (flow.granted)
+            break;
+
+        // wait for the time the request with the lowest tag needs to gather enough tokens or someone else dispatching it
+        uint64_t missingTokens = m_flows[m_pendingFlows.begin()->second].requested - m_tokens;
+        std::chrono::microseconds waitTime(std::max<uint64_t>(missingTokens * 1000000 / m_rateLimit, 1000));
+        m_grantCond.wait_for(lock, waitTime);
+    }
+
+    return flow.requested;
+}
+
+void BandwidthScheduler::Refill()
+{
+    Clock::time_point now = Clock::now();
+    uint64_t elapsedUsecs = std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastRefill).count();
+    uint64_t newTokens = m_rateLimit * elapsedUsecs / 1000000;
+    if (!newTokens)
+        return;
+
+    // move the refill point only by the time the new tokens correspond to, so we don't lose the fractions
+    m_lastRefill += std::chrono::microseconds(newTokens * 1000000 / m_rateLimit);
+    m_tokens = std::min(m_tokens + newTokens, m_burst);
+    if (m_tokens == m_burst)
+        m_lastRefill = now;
+}
+
+void BandwidthScheduler::Dispatch()
+{
+    bool anyGranted = false;
+
+    while (!m_pendingFlows.empty())
+    {
+        auto pendingItr = m_pendingFlows.begin();
+        Flow& flow = m_flows[pendingItr->second];
+        if (m_tokens < flow.requested)
+            break;
+
+        m_tokens -= flow.requested;
+        m_virtualTime = pendingItr->first;
+        flow.granted = true;
+        m_pendingFlows.erase(pendingItr);
+        anyGranted = true;
+    }
+
+    if (anyGranted)
+        m_grantCond.notify_all();
+}
@@ -0,0 +1,76 @@
+#ifndef BANDWIDTH_SCHEDULER_H
+#define BANDWIDTH_SCHEDULER_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+
+#define SCHEDULER_MIN_BURST     4096
+#define SCHEDULER_BURST_TIME    100
+#define SCHEDULER_WEIGHT_SCALE  8
+
+enum PriorityClass
+{
+    PRIORITY_DEFAULT            = 0,
+    PRIORITY_INTERACTIVE        = 1,
+    PRIORITY_NORMAL             = 2,
+    PRIORITY_BULK               = 3,
+    MAX_PRIORITY
+};
+
+PriorityClass ParsePriorityClass(const std::string& name);
+
+// Weighted fair queuing (self-clocked) of the uplink shared by all sessions of the server. Every
+// request for sending is tagged with the virtual finish time depending on the weight of its
+// priority class and the requests are granted in the order of their tags whenever the token bucket
+// filled with the uplink limit (bytes per second) allows it.
+class BandwidthScheduler
+{
+public:
+    BandwidthScheduler() = delete;
+    BandwidthScheduler(const BandwidthScheduler&) = delete;
+    BandwidthScheduler(uint64_t rateLimit);
+
+    ~BandwidthScheduler();
+
+    uint32_t RegisterFlow(PriorityClass priority);
+    void UnregisterFlow(uint32_t flowId);
+    void SetFlowPriority(uint32_t flowId, PriorityClass priority);
+
+    // blocks until the flow is allowed to send, returns the number of bytes granted (at most 'bytes')
+    uint64_t Acquire(uint32_t flowId, uint64_t bytes);
+
+    uint64_t GetRateLimit() const { return m_rateLimit; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Flow
+    {
+        PriorityClass priority;
+        uint64_t finishTag;
+        uint64_t requested;
+        bool granted;
+    };
+
+    BandwidthScheduler& operator =(const BandwidthScheduler&);
+
+    void Refill();
+    void Dispatch();
+
+    std::mutex m_mutex;
+    std::condition_variable m_grantCond;
+    std::map<uint32_t, Flow> m_flows;
+    std::multimap<uint64_t, uint32_t> m_pendingFlows;
+    uint64_t m_rateLimit;
+    uint64_t m_burst;
+    uint64_t m_tokens;
+    uint64_t m_virtualTime;
+    Clock::time_point m_lastRefill;
+    uint32_t m_nextFlowId;
+};
+
+#endif // BANDWIDTH_SCHEDULER_H
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <functional>
+#include <sys/mman.h>
+#include "BlockCache.h"
+#include "FileUtils.h"
+#include "IPKException.h"
+
+size_t BlockCache::BlockKeyHash::operator ()(const BlockKey& key) const
+{
+    std::hash<uint64_t> hasher;
+    size_t hash = hasher(key.file.inode);
+    hash ^= hasher(key.file.device) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash ^= hasher(key.file.modifyTime) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash ^= hasher(key.blockIndex) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+BlockCache::BlockCache(uint64_t memoryBudget, bool hugePages) : m_arena(nullptr), m_arenaSize(0), m_hits(0), m_misses(0)
+{
+    m_blockCount = memoryBudget / BLOCK_CACHE_BLOCK_SIZE;
+    if (!m_blockCount)
+        return;
+
+    m_arenaSize = (uint64_t)m_blockCount * BLOCK_CACHE_BLOCK_SIZE;
+    void* arena = MAP_FAILED;
+    if (hugePages)
+    {
+        // explicit huge pages need the reserved pool, transparent ones are only the hint when there is none
+        m_arenaSize = (m_arenaSize + BLOCK_CACHE_HUGE_PAGE - 1) / BLOCK_CACHE_HUGE_PAGE * BLOCK_CACHE_HUGE_PAGE;
+        arena = mmap(nullptr, m_arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+
+    if (arena == MAP_FAILED)
+    {
+        arena = mmap(nullptr, m_arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED)
+            throw IPKException("BlockCache::BlockCache - unable to allocate the memory of the cache");
+
+        if (hugePages)
+            madvise(arena, m_arenaSize, MADV_HUGEPAGE);
+    }
+
+    m_arena = (uint8_t*)arena;
+
+    uint32_t shardCount = std::min<uint32_t>(m_blockCount, BLOCK_CACHE_MAX_SHARDS);
+    m_slots.resize(m_blockCount);
+    for (uint32_t i = 0; i < shardCount; ++i)
+    {
+        Shard* shard = new Shard;
+        shard->firstSlot = (uint64_t)m_blockCount * i / shardCount;
+        shard->slotCount = (uint64_t)m_blockCount * (i + 1) / shardCount - shard->firstSlot;
+        shard->clockHand = 0;
+        m_shards.push_back(std::unique_ptr<Shard>(shard));
+
+        for (uint32_t slot = shard->firstSlot; slot < shard->firstSlot + shard->slotCount; ++slot)
+        {
+            m_slots[slot].shard = i;
+            m_slots[slot].pinCount = 0;
+            m_slots[slot].used = false;
+            m_slots[slot].loading = false;
+            m_slots[slot].referenced = false;
+        }
+    }
+}
+
+BlockCache::~BlockCache()
+{
+    if (m_arena)
+        munmap(m_arena, m_arenaSize);
+}
+
+const uint8_t* BlockCache::Pin(int fileFd, const FileKey& fileKey, uint64_t blockIndex, uint32_t& slot)
+{
+    if (!m_blockCount)
+        return nullptr;
+
+    BlockKey key;
+    key.file = fileKey;
+    key.blockIndex = blockIndex;
+    Shard& shard = *m_shards[BlockKeyHash()(key) % m_shards.size()];
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto itr = shard.blocks.find(key);
+    if (itr != shard.blocks.end())
+    {
+        Slot& hitSlot = m_slots[itr->second];
+        hitSlot.pinCount++;
+        hitSlot.referenced = true;
+
+        // block is just being read by the other session
+        while (hitSlot.loading)
+            shard.loaded.wait(lock);
+
+        if (!hitSlot.used)
+        {
+            hitSlot.pinCount--;
+            return nullptr;
+        }
+
+        m_hits++;
+        slot = itr->second;
+        return m_arena + (uint64_t)slot * BLOCK_CACHE_BLOCK_SIZE;
+    }
+
+    m_misses++;
+    uint32_t victim;
+    if (!FindVictim(shard, victim))
+        return nullptr;
+
+    Slot& missSlot = m_slots[victim];
+    if (missSlot.used)
+        shard.blocks.erase(missSlot.key);
+
+    missSlot.key = key;
+    missSlot.used = true;
+    missSlot.loading = true;
+    missSlot.referenced = true;
+    missSlot.pinCount = 1;
+    shard.blocks[key] = victim;
+
+    // the block is read without the lock, other blocks of the shard are still served meanwhile
+    lock.unlock();
+    uint64_t offset = blockIndex * BLOCK_CACHE_BLOCK_SIZE;
+    uint8_t* block = m_arena + (uint64_t)victim * BLOCK_CACHE_BLOCK_SIZE;
+    bool loaded = offset < fileKey.size &&
+        ReadFileAt(fileFd, (char*)block, std::min<uint64_t>(BLOCK_CACHE_BLOCK_SIZE, fileKey.size - offset), offset);
+    lock.lock();
+
+    missSlot.loading = false;
+    if (!loaded)
+    {
+        shard.blocks.erase(key);
+        missSlot.used = false;
+        missSlot.pinCount--;
+    }
+
+    shard.loaded.notify_all();
+    if (!loaded)
+        return nullptr;
+
+    slot = victim;
+    return block;
+}
+
+void BlockCache::Release(uint32_t slot)
+{
+    std::lock_guard<std::mutex> lock(m_shards[m_slots[slot].shard]->mutex);
+    m_slots[slot].pinCount--;
+}
+
+bool BlockCache::FindVictim(Shard& shard, uint32_t& victim)
+{
+    // two rounds at most, the first one may only clear the reference bits
+    for (uint32_t step = 0; step < 2 * shard.slotCount; ++step)
+    {
+        uint32_t slot = shard.firstSlot + shard.clockHand;
+        shard.clockHand = (shard.clockHand + 1) % shard.slotCount;
+
+        Slot& candidate = m_slots[slot];
+        if (candidate.pinCount)
+            continue;
+
+        if (candidate.used && candidate.referenced)
+        {
+            candidate.referenced = false;
+            continue;
+        }
+
+        victim = slot;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,132 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
+#include <condition_variable>
+#include <sys/types.h>
+
+#define BLOCK_CACHE_BLOCK_SIZE  65536
+#define BLOCK_CACHE_MAX_SHARDS  16
+#define BLOCK_CACHE_HUGE_PAGE   (2 * 1024 * 1024)
+
+// identity of the file content, modified file gets the new key and its old blocks are evicted in time
+struct FileKey
+{
+    dev_t device;
+    ino_t inode;
+    uint64_t size;
+    int64_t modifyTime;
+};
+
+// Fixed-size blocks of the file content kept in one preallocated arena within the memory budget. Blocks are
+// divided among the shards by the hash of their key, each shard has its own lock and evicts by CLOCK. Pinned
+// block stays in place until it is released, so it can be sent straight from the arena.
+class BlockCache
+{
+public:
+    BlockCache() = delete;
+    BlockCache(const BlockCache&) = delete;
+    BlockCache(uint64_t memoryBudget, bool hugePages);
+
+    ~BlockCache();
+
+    // returns the pinned block 'blockIndex' of the file, read from 'fileFd' on the miss, nullptr if it is unavailable
+    const uint8_t* Pin(int fileFd, const FileKey& fileKey, uint64_t blockIndex, uint32_t& slot);
+    void Release(uint32_t slot);
+
+    uint64_t GetHits() const { return m_hits; }
+    uint64_t GetMisses() const { return m_misses; }
+    uint64_t GetMemorySize() const { return (uint64_t)m_blockCount * BLOCK_CACHE_BLOCK_SIZE; }
+
+private:
+    struct BlockKey
+    {
+        FileKey file;
+        uint64_t blockIndex;
+
+        bool operator ==(const BlockKey& other) const
+        {
+            return file.device == other.file.device && file.inode == other.file.inode && file.size == other.file.size &&
+                file.modifyTime == other.file.modifyTime && blockIndex == other.blockIndex;
+        }
+    };
+
+    struct BlockKeyHash
+    {
+        size_t operator ()(const BlockKey& key) const;
+    };
+
+    struct Slot
+    {
+        BlockKey key;
+        uint32_t shard;
+        uint32_t pinCount;
+        bool used;
+        bool loading;
+        bool referenced;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::condition_variable loaded;
+        std::unordered_map<BlockKey, uint32_t, BlockKeyHash> blocks;
+        uint32_t firstSlot;
+        uint32_t slotCount;
+        uint32_t clockHand;
+    };
+
+    BlockCache& operator =(const BlockCache&);
+
+    // second chance for the referenced slots, pinned ones are skipped, returns false if every slot is pinned
+    bool FindVictim(Shard& shard, uint32_t& victim);
+
+    uint8_t* m_arena;
+    uint64_t m_arenaSize;
+    uint32_t m_blockCount;
+    std::vector<Slot> m_slots;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+// Blocks pinned for one send, all of them are released together when it is done
+class BlockPins
+{
+public:
+    BlockPins() = delete;
+    BlockPins(const BlockPins&) = delete;
+    BlockPins(BlockCache& cache) : m_cache(cache) { }
+    ~BlockPins() { Clear(); }
+
+    const uint8_t* Pin(int fileFd, const FileKey& fileKey, uint64_t blockIndex)
+    {
+        uint32_t slot;
+        const uint8_t* block = m_cache.Pin(fileFd, fileKey, blockIndex, slot);
+        if (block)
+            m_slots.push_back(slot);
+
+        return block;
+    }
+
+    void Clear()
+    {
+        for (uint32_t slot : m_slots)
+            m_cache.Release(slot);
+
+        m_slots.clear();
+    }
+
+private:
+    BlockPins& operator =(const BlockPins&);
+
+    BlockCache& m_cache;
+    std::vector<uint32_t> m_slots;
+};
+
+#endif // BLOCK_CACHE_H
@@ -1,26 +1,44 @@
 #include <iostream>
-#include <fstream>
+#include <fcntl.h>
 #include "Client.h"
+#include "FileUtils.h"
+#include "Logger.h"
 
-Client::Client(const std::string& hostname, uint16_t port, const std::string& downloadFile) : Service(hostname, port), m_downloadFile(downloadFile) {}
+Client::Client(const std::string& hostname, uint16_t port, const std::string& downloadFile, PriorityClass priority) : Service(hostname, port), m_downloadFile(downloadFile),
+    m_priority(priority), m_zeroRtt(true), m_fastOpen(false), m_uncached(false) {}
+
+Client::Client(const std::string& localPath, const std::string& downloadFile, PriorityClass priority) : Service(new PacketSocket(localPath)), m_downloadFile(downloadFile),
+    m_priority(priority), m_zeroRtt(true), m_fastOpen(false), m_uncached(false) {}
 
 Client::~Client() { }
 
 void Client::Run()
 {
     m_socket->Open();
-    m_socket->Connect();
     m_socket->SetReusableAddress(true);
+    m_socket->SetNoDelay(true);
+    if (m_fastOpen)
+        m_socket->SetFastOpenConnect(true);
+    m_socket->Connect();
 
     Packet* packet = nullptr;
 
-    SendMessage(m_socket, CMSG_HANDSHAKE_REQUEST, sizeof(uint16_t), (uint16_t)1337);
-
-    packet = ReceiveMessage(m_socket);
-    if (!HandleHandshakeResponse(m_socket, packet))
+    if (m_zeroRtt)
     {
-        m_socket->Close();
-        return;
+        // handshake and download request in one message, with TCP Fast Open it even goes with SYN
+        SendMessage(m_socket, CMSG_HANDSHAKE_DOWNLOAD, sizeof(uint16_t) + m_downloadFile.length() + 1 + sizeof(uint8_t) + sizeof(uint8_t),
+            (uint16_t)CLIENT_MAGIC, m_downloadFile, (uint8_t)m_priority, GetDownloadFlags());
+    }
+    else
+    {
+        SendMessage(m_socket, CMSG_HANDSHAKE_REQUEST, sizeof(uint16_t), (uint16_t)CLIENT_MAGIC);
+
+        packet = ReceiveMessage(m_socket);
+        if (!HandleHandshakeResponse(m_socket, packet))
+        {
+            m_socket->Close();
+            return;
+        }
     }
 
     packet = ReceiveMessage(m_socket);
@@ -40,6 +58,32 @@ void Client::Run()
     m_socket->Close();
 }
 
+void Client::SetZeroRtt(bool zeroRtt)
+{
+    m_zeroRtt = zeroRtt;
+}
+
+void Client::SetFastOpen(bool fastOpen)
+{
+    m_fastOpen = fastOpen;
+}
+
+void Client::SetUncached(bool uncached)
+{
+    m_uncached = uncached;
+}
+
+uint8_t Client::GetDownloadFlags() const
+{
+    uint8_t flags = DOWNLOAD_FLAG_SPARSE;
+    if (m_socket->IsLocal())
+        flags |= DOWNLOAD_FLAG_DESCRIPTOR;
+    if (m_uncached)
+        flags |= DOWNLOAD_FLAG_UNCACHED;
+
+    return flags;
+}
+
 bool Client::HandleHandshakeResponse(SocketPtr socket, Packet* packet)
 {
     if (!packet)
@@ -49,7 +93,8 @@ bool Client::HandleHandshakeResponse(SocketPtr socket, Packet* packet)
         return false;
 
     // TODO length of m_downloadFile can be > 255
-    SendMessage(socket, CMSG_DOWNLOAD_REQUEST, m_downloadFile.length() + 1, m_downloadFile);
+    SendMessage(socket, CMSG_DOWNLOAD_REQUEST, m_downloadFile.length() + 1 + sizeof(uint8_t) + sizeof(uint8_t), m_downloadFile, (uint8_t)m_priority,
+        GetDownloadFlags());
     return true;
 }
 /*
@@ -69,25 +114,103 @@ bool Client::HandleDownloadResponse(SocketPtr socket, Packet* packet)
     *packet >> result;
 
     if (!result)
+    {
+        LOG_WARNING(SMSG_DOWNLOAD_RESPONSE, 0, 0, "file not available: " + m_downloadFile);
         return true;
+    }
 
     uint64_t fileSize;
     *packet >> fileSize;
 
+    LogTimer downloadTimer;
     uint64_t bytesRecvd = 0;
-    std::ofstream file(m_downloadFile, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+    int fileFd = open(m_downloadFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fileFd == -1)
+        throw IPKException("Client::HandleDownloadResponse - unable to open output file");
+
+    // the file is created with its final size as one big hole, so skipping over the holes we receive keeps them sparse
+    if (ftruncate(fileFd, fileSize) != 0)
+    {
+        close(fileFd);
+        throw IPKException("Client::HandleDownloadResponse - unable to resize output file");
+    }
 /*
     std::list<std::pair<uint64_t, uint64_t>> downloadHistory;
     downloadHistory.clear();*/
 
+    try
+    {
+        ReceiveFileData(socket, fileFd, fileSize, bytesRecvd);
+    }
+    catch (const IPKException& ex)
+    {
+        // file has its final size from the start, so what we didn't get mustn't stay there looking like the data
+        close(fileFd);
+        unlink(m_downloadFile.c_str());
+        throw;
+    }
+
+    close(fileFd);
+
+    if (bytesRecvd != fileSize)
+    {
+        LOG_WARNING(SMSG_DOWNLOAD_DATA, bytesRecvd, downloadTimer.GetDurationUs(), "download incomplete: " + m_downloadFile);
+        unlink(m_downloadFile.c_str());
+        throw IPKException("Client::HandleDownloadResponse - download incomplete");
+    }
+
+    LOG_INFO(SMSG_DOWNLOAD_DATA, fileSize, downloadTimer.GetDurationUs(), m_downloadFile);
+
+    SendMessage(socket, XMSG_FAREWELL, 0);
+    return true;
+}
+
+void Client::ReceiveFileData(SocketPtr socket, int fileFd, uint64_t fileSize, uint64_t& bytesRecvd)
+{
     while (bytesRecvd < fileSize)
     {
         Packet* dataPacket = ReceiveMessage(socket);
         if (!dataPacket)
             break;
 
-        file.write((const char*)dataPacket->GetDataBuffer(), dataPacket->GetDataLength());
+        if (dataPacket->GetOpcode() == SMSG_DOWNLOAD_HOLE)
+        {
+            uint64_t holeLength;
+            *dataPacket >> holeLength;
+            delete dataPacket;
+            if (holeLength > fileSize - bytesRecvd)
+                break;
+
+            bytesRecvd += holeLength;
+            continue;
+        }
+
+        // server passed us the file itself, copy it without going through the socket
+        if (dataPacket->GetOpcode() == SMSG_DOWNLOAD_DESCRIPTOR)
+        {
+            delete dataPacket;
+            int sourceFd = socket->GetReceivedDescriptor();
+            if (sourceFd == -1)
+                break;
+
+            bool copied = CopyFileData(sourceFd, fileFd, fileSize);
+            close(sourceFd);
+            if (!copied)
+                break;
+
+            bytesRecvd = fileSize;
+            continue;
+        }
+
+        if (dataPacket->GetDataLength() > fileSize - bytesRecvd ||
+            !WriteFileAt(fileFd, dataPacket->GetDataBuffer(), dataPacket->GetDataLength(), bytesRecvd))
+        {
+            delete dataPacket;
+            break;
+        }
+
         bytesRecvd += dataPacket->GetDataLength();
+        delete dataPacket;
 
         /*uint64_t actualTime = time(NULL);
         downloadHistory.push_back(std::pair<uint64_t, uint64_t>(actualTime, dataPacket->GetDataLength()));
@@ -98,15 +221,7 @@ bool Client::HandleDownloadResponse(SocketPtr socket, Packet* packet)
         for (auto itr = downloadHistory.begin(); itr != downloadHistory.end(); ++itr)
             speed += itr->second;
         std::cout << "Current speed is " << speed << " B/S" << std::endl;*/
-
-        file.flush();
     }
-
-    if (bytesRecvd != fileSize)
-        return false;
-
-    SendMessage(socket, XMSG_FAREWELL, 0);
-    return true;
 }
 
 bool Client::HandleFarewell(SocketPtr socket, Packet* packet)
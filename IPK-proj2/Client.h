@@ -4,26 +4,41 @@
 #include <string>
 #include <cstdint>
 #include "Service.h"
-#include "Socket.h"
+#include "PacketSocket.h"
+#include "BandwidthScheduler.h"
 
 class Client : public Service
 {
 public:
     Client() = delete;
     Client(const Client&) = delete;
-    Client(const std::string& hostname, uint16_t port, const std::string& downloadFile);
+    Client(const std::string& hostname, uint16_t port, const std::string& downloadFile, PriorityClass priority = PRIORITY_DEFAULT);
+    Client(const std::string& localPath, const std::string& downloadFile, PriorityClass priority = PRIORITY_DEFAULT);
 
     ~Client();
 
     void Run();
 
+    void SetZeroRtt(bool zeroRtt);
+    void SetFastOpen(bool fastOpen);
+    // one-off download of a cold file, server doesn't let it displace the hot ones in its caches
+    void SetUncached(bool uncached);
+
 protected:
     bool HandleHandshakeResponse(SocketPtr socket, Packet* packet);
     bool HandleDownloadResponse(SocketPtr socket, Packet* packet);
     bool HandleFarewell(SocketPtr socket, Packet* packet);
 
+    uint8_t GetDownloadFlags() const;
+    // stops at the end of the file or at the first packet which doesn't fit into it
+    void ReceiveFileData(SocketPtr socket, int fileFd, uint64_t fileSize, uint64_t& bytesRecvd);
+
 private:
     std::string m_downloadFile;
+    PriorityClass m_priority;
+    bool m_zeroRtt;
+    bool m_fastOpen;
+    bool m_uncached;
 };
 
 #endif // CLIENT_H
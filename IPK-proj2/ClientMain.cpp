@@ -1,7 +1,9 @@
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <cstring>
+#include <cctype>
 #include "Client.h"
-#include "Regex.h"
+#include "Logger.h"
 #include "IPKException.h"
 
 #include <signal.h>
@@ -9,32 +11,98 @@ void dummySigPipe(int)
 {
 }
 
+// <host>:<port>/<file>, file can't contain another slash
+bool parseAddress(const char* address, std::string& host, uint16_t& port, std::string& file)
+{
+    const char* hostEnd = address;
+    while (*hostEnd && *hostEnd != ':' && *hostEnd != '/')
+        hostEnd++;
+
+    if (hostEnd == address || *hostEnd != ':')
+        return false;
+
+    uint32_t portNumber = 0;
+    const char* pos = hostEnd + 1;
+    while (isdigit(*pos) && portNumber <= UINT16_MAX)
+        portNumber = portNumber * 10 + (*pos++ - '0');
+
+    if (pos == hostEnd + 1 || portNumber > UINT16_MAX || *pos != '/' || !pos[1] || strchr(pos + 1, '/'))
+        return false;
+
+    host.assign(address, hostEnd);
+    port = portNumber;
+    file.assign(pos + 1);
+    return true;
+}
+
 int main(int argc, char** argv)
 {
     signal(SIGPIPE, &dummySigPipe);
 
     try
     {
-        if (argc != 2)
+        // [-c <priority class>] [-f] [-s] [-o] [-L <log file>] <host>:<port>/<file>
+        //    | [-c <priority class>] [-s] [-L <log file>] -l <local socket> <file>
+        // -o asks the server not to keep the file in its caches
+        PriorityClass priority = PRIORITY_DEFAULT;
+        bool fastOpen = false, zeroRtt = true, uncached = false;
+        const char* localPath = nullptr;
+        const char* logPath = nullptr;
+        for (int i = 1; i < argc - 1; ++i)
+        {
+            if (strcmp(argv[i], "-c") == 0 && i + 1 < argc - 1)
+                priority = ParsePriorityClass(argv[++i]);
+            else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc - 1)
+                localPath = argv[++i];
+            else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc - 1)
+                logPath = argv[++i];
+            else if (strcmp(argv[i], "-f") == 0)
+                fastOpen = true;
+            else if (strcmp(argv[i], "-s") == 0)
+                zeroRtt = false;
+            else if (strcmp(argv[i], "-o") == 0)
+                uncached = true;
+            else
+                throw IPKException("main - invalid parameters");
+        }
+
+        if (argc < 2)
             throw IPKException("main - invalid count of parameters");
 
-        Regex addressRegex(R"(^([^:/]+):([0-9]+)/([^/]+)$)");
+        if (logPath)
+            Logger::Start(logPath, false);
 
-        MatchList matches;
-        if (!addressRegex.Match(argv[1], 4, matches))
-            throw IPKException("main - invalid parameter");
+        std::unique_ptr<Client> client;
+        if (localPath)
+        {
+            if (!*argv[argc - 1] || strchr(argv[argc - 1], '/'))
+                throw IPKException("main - invalid parameter");
 
-        std::string host = matches[1];
-        std::string downloadFile = matches[3];
-        std::stringstream portStream(matches[2]);
-        uint16_t port;
-        portStream >> port;
+            client.reset(new Client(localPath, argv[argc - 1], priority));
+        }
+        else
+        {
+            std::string host, downloadFile;
+            uint16_t port;
+            if (!parseAddress(argv[argc - 1], host, port, downloadFile))
+                throw IPKException("main - invalid parameter");
 
-        Client client(host, port, downloadFile);
-        client.Run();
+            client.reset(new Client(host, port, downloadFile, priority));
+        }
+
+        client->SetZeroRtt(zeroRtt);
+        client->SetFastOpen(fastOpen);
+        client->SetUncached(uncached);
+        client->Run();
     }
     catch(const IPKException& ex)
     {
+        LOG_ERROR(0, 0, 0, ex.what());
         std::cerr << ex.what() << std::endl;
+        Logger::Stop();
+        return 1;
     }
+
+    Logger::Stop();
+    return 0;
 }
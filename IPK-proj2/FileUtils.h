@@ -0,0 +1,194 @@
+#ifndef FILE_UTILS_H
+#define FILE_UTILS_H
+
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+
+#define DIRECT_IO_ALIGNMENT     4096
+#define DIRECT_IO_BUFFER_SIZE   (1024 * 1024)
+
+// finds the data extent starting at or after 'offset', the area between 'offset' and 'dataStart' is a hole, the extent
+// never reaches past 'fileSize' even if the file has grown since
+inline void FindDataExtent(int fileFd, uint64_t fileSize, uint64_t offset, uint64_t& dataStart, uint64_t& dataEnd)
+{
+    dataStart = offset;
+    dataEnd = fileSize;
+
+    off_t pos = lseek(fileFd, offset, SEEK_DATA);
+    if (pos == -1)
+    {
+        // no more data after offset, the rest of the file is one big hole
+        if (errno == ENXIO)
+            dataStart = fileSize;
+
+        // otherwise filesystem doesn't support holes, so treat everything as data
+        return;
+    }
+
+    dataStart = std::min((uint64_t)pos, fileSize);
+    pos = lseek(fileFd, dataStart, SEEK_HOLE);
+    if (pos != -1)
+        dataEnd = std::min((uint64_t)pos, fileSize);
+}
+
+inline bool ReadFileAt(int fileFd, char* buffer, uint64_t bytes, uint64_t offset)
+{
+    uint64_t bytesRead = 0;
+    while (bytesRead < bytes)
+    {
+        ssize_t res = pread(fileFd, buffer + bytesRead, bytes - bytesRead, offset + bytesRead);
+        if (res == -1 && errno == EINTR)
+            continue;
+
+        if (res <= 0)
+            return false;
+
+        bytesRead += res;
+    }
+
+    return true;
+}
+
+inline bool WriteFileAt(int fileFd, const uint8_t* buffer, uint64_t bytes, uint64_t offset)
+{
+    uint64_t bytesWritten = 0;
+    while (bytesWritten < bytes)
+    {
+        ssize_t res = pwrite(fileFd, buffer + bytesWritten, bytes - bytesWritten, offset + bytesWritten);
+        if (res == -1 && errno == EINTR)
+            continue;
+
+        if (res <= 0)
+            return false;
+
+        bytesWritten += res;
+    }
+
+    return true;
+}
+
+// Reads of the file bypassing the page cache (O_DIRECT). Kernel reads only aligned blocks into the aligned buffer,
+// so the data are read into the window and copied out of it from there. The descriptor already opened (and checked)
+// is switched to the direct mode and stays in it. Where the filesystem can't read directly, the reads are buffered
+// and the pages they went through are dropped.
+class DirectFileReader
+{
+public:
+    DirectFileReader() = delete;
+    DirectFileReader(const DirectFileReader&) = delete;
+    explicit DirectFileReader(int fileFd) : m_fileFd(fileFd), m_direct(false), m_buffer(nullptr), m_windowStart(0), m_windowLength(0)
+    {
+        int fileFlags = fcntl(m_fileFd, F_GETFL);
+        if (fileFlags == -1 || posix_memalign((void**)&m_buffer, DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE) != 0)
+        {
+            m_buffer = nullptr;
+            return;
+        }
+
+        m_direct = (fcntl(m_fileFd, F_SETFL, fileFlags | O_DIRECT) == 0);
+    }
+
+    ~DirectFileReader()
+    {
+        free(m_buffer);
+    }
+
+    bool Read(char* buffer, uint64_t bytes, uint64_t offset)
+    {
+        while (bytes > 0)
+        {
+            if (!m_direct)
+            {
+                if (!ReadFileAt(m_fileFd, buffer, bytes, offset))
+                    return false;
+
+                posix_fadvise(m_fileFd, offset, bytes, POSIX_FADV_DONTNEED);
+                return true;
+            }
+
+            if (offset < m_windowStart || offset >= m_windowStart + m_windowLength)
+            {
+                m_windowStart = offset & ~((uint64_t)DIRECT_IO_ALIGNMENT - 1);
+                m_windowLength = 0;
+
+                ssize_t res;
+                do
+                {
+                    res = pread(m_fileFd, m_buffer, DIRECT_IO_BUFFER_SIZE, m_windowStart);
+                } while (res == -1 && errno == EINTR);
+
+                // some filesystems take the flag and only refuse the reads themselves
+                if (res == -1 && errno == EINVAL)
+                {
+                    fcntl(m_fileFd, F_SETFL, fcntl(m_fileFd, F_GETFL) & ~O_DIRECT);
+                    m_direct = false;
+                    continue;
+                }
+
+                // the last block of the file is read short
+                if (res <= 0 || m_windowStart + res <= offset)
+                    return false;
+
+                m_windowLength = res;
+            }
+
+            uint64_t available = std::min(m_windowStart + m_windowLength - offset, bytes);
+            memcpy(buffer, m_buffer + (offset - m_windowStart), available);
+            buffer += available;
+            offset += available;
+            bytes -= available;
+        }
+
+        return true;
+    }
+
+private:
+    DirectFileReader& operator =(const DirectFileReader&);
+
+    int m_fileFd;
+    bool m_direct;
+    char* m_buffer;
+    uint64_t m_windowStart;
+    uint64_t m_windowLength;
+};
+
+// copies the file inside the kernel, only data extents are copied so 'outFd' (already truncated to 'fileSize') stays sparse
+inline bool CopyFileData(int inFd, int outFd, uint64_t fileSize)
+{
+    uint64_t offset = 0;
+    while (offset < fileSize)
+    {
+        uint64_t dataStart, dataEnd;
+        FindDataExtent(inFd, fileSize, offset, dataStart, dataEnd);
+        if (dataStart >= fileSize)
+            break;
+
+        if (lseek(outFd, dataStart, SEEK_SET) == -1)
+            return false;
+
+        off_t inOffset = dataStart;
+        while ((uint64_t)inOffset < dataEnd)
+        {
+            ssize_t res = sendfile(outFd, inFd, &inOffset, dataEnd - inOffset);
+            if (res == -1 && errno == EINTR)
+                continue;
+
+            if (res <= 0)
+                return false;
+        }
+
+        offset = dataEnd;
+    }
+
+    return true;
+}
+
+#endif // FILE_UTILS_H
@@ -5,6 +5,8 @@
 #include <cstring>
 
 #define PACKET_HEADER_SIZE      (sizeof(uint8_t) + sizeof(uint32_t))
+#define CLIENT_MAGIC            1337
+#define SERVER_MAGIC            42
 
 enum PacketOpcode
 {
@@ -14,6 +16,16 @@ enum PacketOpcode
     SMSG_DOWNLOAD_RESPONSE      = 3,
     SMSG_DOWNLOAD_DATA          = 4,
     XMSG_FAREWELL               = 5,
+    CMSG_HANDSHAKE_DOWNLOAD     = 6,
+    SMSG_DOWNLOAD_HOLE          = 7,
+    SMSG_DOWNLOAD_DESCRIPTOR    = 8,
+};
+
+enum DownloadFlags
+{
+    DOWNLOAD_FLAG_SPARSE        = 0x01,
+    DOWNLOAD_FLAG_DESCRIPTOR    = 0x02,
+    DOWNLOAD_FLAG_UNCACHED      = 0x04,
 };
 
 class Packet
@@ -157,6 +169,7 @@ protected:
         }
 
         data = std::string((const char*)&m_buffer[m_readPos], strLen);
+        m_readPos += strLen;
     }
 
 private:
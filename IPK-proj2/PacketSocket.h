@@ -0,0 +1,178 @@
+#ifndef PACKET_SOCKET_H
+#define PACKET_SOCKET_H
+
+#include <string>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sys/uio.h>
+#include "Socket.h"
+#include "IPKException.h"
+#include "Packet.h"
+
+class PacketSocket;
+typedef std::shared_ptr<PacketSocket> SocketPtr;
+typedef std::weak_ptr<PacketSocket> SocketPtrw;
+
+// Socket of the shared library carrying the protocol packets
+class PacketSocket : public Socket
+{
+public:
+    PacketSocket() = delete;
+    PacketSocket(const PacketSocket&) = delete;
+    PacketSocket(const std::string& hostname, uint16_t port) : Socket(hostname, port), m_bufferBytesRead(0), m_pendingPacket(nullptr) { }
+    explicit PacketSocket(const std::string& path) : Socket(path), m_bufferBytesRead(0), m_pendingPacket(nullptr) { }
+    PacketSocket(int socketFd, const sockaddr_storage* socketAddr, socklen_t socketAddrLen) : Socket(socketFd, socketAddr, socketAddrLen),
+        m_bufferBytesRead(0), m_pendingPacket(nullptr) { }
+
+    ~PacketSocket()
+    {
+        delete m_pendingPacket;
+        while (!m_recvPacketQueue.empty())
+        {
+            delete m_recvPacketQueue.front();
+            m_recvPacketQueue.pop();
+        }
+    }
+
+    SocketPtr Accept(uint32_t timeoutSec)
+    {
+        sockaddr_storage sessionAddress;
+        socklen_t sessionAddressLen;
+        int sessionSocket = AcceptHandle(timeoutSec, sessionAddress, sessionAddressLen);
+        if (sessionSocket == INVALID_SOCKET)
+            return nullptr;
+
+        return SocketPtr(new PacketSocket(sessionSocket, &sessionAddress, sessionAddressLen));
+    }
+
+    void Send(const Packet& packet)
+    {
+        Socket::Send(packet.GetBuffer(), packet.GetLength());
+    }
+
+    // header is sent from the stack and the data straight from the caller's buffer, they aren't copied into the packet
+    void SendData(uint8_t opcode, const uint8_t* data, uint32_t dataLength)
+    {
+        iovec part;
+        part.iov_base = const_cast<uint8_t*>(data);
+        part.iov_len = dataLength;
+        SendData(opcode, &part, 1, dataLength);
+    }
+
+    // data of the packet gathered from more buffers
+    void SendData(uint8_t opcode, const iovec* dataParts, uint32_t partCount, uint32_t dataLength)
+    {
+        uint8_t header[PACKET_HEADER_SIZE];
+        header[0] = opcode;
+        memcpy(&header[1], &dataLength, sizeof(uint32_t));
+
+        std::vector<iovec> parts(partCount + 1);
+        parts[0].iov_base = header;
+        parts[0].iov_len = PACKET_HEADER_SIZE;
+        std::copy(dataParts, dataParts + partCount, parts.begin() + 1);
+        SendVector(parts.data(), parts.size());
+    }
+
+    // sends the packet together with the file descriptor, local sockets only
+    void SendDescriptor(const Packet& packet, int fd)
+    {
+        Socket::SendDescriptor(packet.GetBuffer(), packet.GetLength(), fd);
+    }
+
+    // waits for the packet up to 'maxTimeoutCount' recv timeouts, once one is complete only the data already waiting
+    // on the socket are taken and the call returns
+    bool Recv(uint32_t maxTimeoutCount = 1)
+    {
+        uint32_t timeoutCount = 0;
+        int flags = 0;
+
+        while (timeoutCount < maxTimeoutCount)
+        {
+            int64_t bytesRecvd = RecvBytes(m_buffer + m_bufferBytesRead, DEFAULT_BUFFER_SIZE - m_bufferBytesRead, flags);
+
+            if (bytesRecvd == 0) // remote endpoint disconnected
+                return false;
+            else if (bytesRecvd == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    // nothing more has arrived after the packet
+                    if (flags == MSG_DONTWAIT)
+                        break;
+
+                    // recv timed out
+                    timeoutCount++;
+                    continue;
+                }
+
+                throw IPKException("Socket::Recv - error occured during transmission");
+            }
+            else if (!m_pendingPacket && bytesRecvd + m_bufferBytesRead < (int64_t)(PACKET_HEADER_SIZE))
+            {
+                m_bufferBytesRead += bytesRecvd;
+            }
+            else
+            {
+                // pending packet may be finished by less bytes than the header has
+                bytesRecvd += m_bufferBytesRead;
+                while ((m_pendingPacket && bytesRecvd > 0) || bytesRecvd >= (int64_t)(PACKET_HEADER_SIZE))
+                {
+                    uint32_t movePos = 0;
+                    if (!m_pendingPacket)
+                    {
+                        m_pendingPacket = new Packet(m_buffer, bytesRecvd);
+                        movePos = m_pendingPacket->GetCurrentLength();
+                    }
+                    else
+                    {
+                        movePos = m_pendingPacket->GetCurrentLength();
+                        m_pendingPacket->AppendBuffer(m_buffer, bytesRecvd);
+                        movePos = m_pendingPacket->GetCurrentLength() - movePos;
+                    }
+
+                    memmove(m_buffer, m_buffer + movePos, bytesRecvd - movePos);
+                    bytesRecvd -= movePos;
+
+                    if (m_pendingPacket->IsValid())
+                    {
+                        m_recvPacketQueue.push(m_pendingPacket);
+                        m_pendingPacket = nullptr;
+                        flags = MSG_DONTWAIT;
+                    }
+                    else
+                        break;
+                }
+                m_bufferBytesRead = bytesRecvd;
+            }
+        }
+
+        return true;
+    }
+
+    Packet* GetReceivedPacket()
+    {
+        if (m_recvPacketQueue.empty())
+            return nullptr;
+
+        Packet* packet = m_recvPacketQueue.front();
+        m_recvPacketQueue.pop();
+        return packet;
+    }
+
+private:
+    PacketSocket& operator =(const PacketSocket&);
+
+    uint8_t m_buffer[DEFAULT_BUFFER_SIZE];
+    uint32_t m_bufferBytesRead;
+    Packet* m_pendingPacket;
+    std::queue<Packet*> m_recvPacketQueue;
+};
+
+#endif // PACKET_SOCKET_H
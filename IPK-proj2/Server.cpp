@@ -1,71 +1,316 @@
 #include <iostream>
 #include <thread>
-#include <fstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
 #include "Server.h"
+#include "FileUtils.h"
+#include "Logger.h"
 #include "IPKException.h"
 
-Server::Server(const std::string& hostname, uint16_t port, uint64_t speedLimit) : Service(hostname, port), m_running(false), m_sessionCount(0), m_speedLimit(speedLimit)
+Server::Server(const std::string& hostname, uint16_t port, uint64_t speedLimit, uint64_t uplinkLimit) : Service(hostname, port), m_running(false), m_sessionCount(0), m_lastSessionId(0), m_speedLimit(speedLimit),
+    m_scheduler(uplinkLimit * IN_KILOBYTES), m_fastOpen(false), m_sendBufferSize(0), m_writeTimeout(DEFAULT_WRITE_TIMEOUT), m_maxSessions(0), m_listenerShards(0),
+    m_uncachedThreshold(0)
 {
+    // created right away, so Stop() called before Run() isn't lost
+    m_stopEvent = eventfd(0, EFD_CLOEXEC);
+    if (m_stopEvent == -1)
+        throw IPKException("Server::Server - unable to create stop event");
 }
 
-Server::~Server() { }
+Server::~Server()
+{
+    close(m_stopEvent);
+}
 
 void Server::Run()
 {
-    m_socket->Open();
-    m_socket->Bind();
-    m_socket->Listen();
-    m_socket->SetReusableAddress(true);
+    std::vector<int> cores = GetAvailableCores();
+    uint32_t shardCount = m_listenerShards ? m_listenerShards : cores.size();
+
+    // every shard has its own listening socket on the same port, the kernel spreads the incoming connections among them
+    for (uint32_t shard = 0; shard < shardCount; ++shard)
+    {
+        SocketPtr listener = shard ? SocketPtr(new PacketSocket(m_socket->GetHostname(), m_socket->GetPort())) : m_socket;
+        listener->Open();
+        listener->SetReusableAddress(true);
+        if (shardCount > 1)
+            listener->SetReusablePort(true);
+        listener->Bind();
+        if (m_fastOpen)
+            listener->SetFastOpen(FAST_OPEN_QUEUE_SIZE);
+        listener->Listen();
+        m_listeners.push_back(listener);
+    }
+
+    if (!m_localPath.empty())
+    {
+        m_localSocket = SocketPtr(new PacketSocket(m_localPath));
+        m_localSocket->Open();
+        m_localSocket->Bind();
+        m_localSocket->Listen();
+    }
 
     m_running = true;
-    while (m_running)
+    std::vector<std::thread> shardThreads;
+    for (uint32_t shard = 0; shard < shardCount; ++shard)
+        shardThreads.push_back(std::thread(&Server::AcceptLoop, this, shard, shardCount > 1 ? cores[shard % cores.size()] : -1));
+
+    for (std::thread& shardThread : shardThreads)
+        shardThread.join();
+
+    for (SocketPtr& listener : m_listeners)
+        listener->Close();
+
+    m_listeners.clear();
+    if (m_localSocket)
+    {
+        m_localSocket->Close();
+        unlink(m_localPath.c_str());
+    }
+
+    // running sessions end on their next send or recv, nothing of them may outlive the server
+    std::unique_lock<std::mutex> lock(m_sessionsMutex);
+    for (auto& sessionHandle : m_sessionHandles)
+        shutdown(sessionHandle.second, SHUT_RDWR);
+
+    m_sessionsCondition.wait(lock, [this]() { return m_sessionHandles.empty(); });
+}
+
+void Server::Stop()
+{
+    // stop event stays signaled, so it wakes up all the shards at once
+    m_running = false;
+    uint64_t value = 1;
+    ssize_t written = write(m_stopEvent, &value, sizeof(uint64_t));
+    (void)written;
+}
+
+void Server::AcceptLoop(uint32_t shard, int core)
+{
+    // sessions are started from the pinned thread, so they inherit its core, single listener isn't pinned at all
+    if (core != -1)
+    {
+        cpu_set_t coreSet;
+        CPU_ZERO(&coreSet);
+        CPU_SET(core, &coreSet);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &coreSet);
+    }
+
+    // the local socket is served by the first shard only
+    SocketPtr listener = m_listeners[shard];
+    pollfd acceptFds[3];
+    uint32_t acceptFdCount = (shard == 0 && m_localSocket) ? 3 : 2;
+    acceptFds[0].fd = m_stopEvent;
+    acceptFds[1].fd = listener->GetHandle();
+    if (acceptFdCount > 2)
+        acceptFds[2].fd = m_localSocket->GetHandle();
+
+    for (uint32_t i = 0; i < acceptFdCount; ++i)
+        acceptFds[i].events = POLLIN;
+
+    try
+    {
+        while (m_running)
+        {
+            for (uint32_t i = 0; i < acceptFdCount; ++i)
+                acceptFds[i].revents = 0;
+
+            if (poll(acceptFds, acceptFdCount, -1) <= 0)
+                continue;
+
+            if (!m_running || acceptFds[0].revents)
+                break;
+
+            if (acceptFds[1].revents & POLLIN)
+                StartSession(listener->Accept(0));
+
+            if (acceptFdCount > 2 && (acceptFds[2].revents & POLLIN))
+                StartSession(m_localSocket->Accept(0));
+        }
+    }
+    catch (const IPKException& ex)
     {
-        SocketPtr sessionSocket = m_socket->Accept(3);
+        // failed listener takes the whole server down, as the single one did
+        LOG_ERROR(0, 0, 0, ex.what());
+        std::cerr << ex.what() << std::endl;
+        Stop();
+    }
+}
+
+std::vector<int> Server::GetAvailableCores()
+{
+    std::vector<int> cores;
+    cpu_set_t coreSet;
+    CPU_ZERO(&coreSet);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &coreSet) == 0)
+    {
+        for (int core = 0; core < CPU_SETSIZE; ++core)
+        {
+            if (CPU_ISSET(core, &coreSet))
+                cores.push_back(core);
+        }
+    }
 
-        if (!m_running)
-            break;
+    if (cores.empty())
+        cores.push_back(0);
 
-        if (!sessionSocket)
-            continue;
+    return cores;
+}
+
+void Server::StartSession(SocketPtr sessionSocket)
+{
+    if (!sessionSocket)
+        return;
 
-        m_sessionCount++;
-        std::thread sessionThread(&Server::ProcessSession, this, sessionSocket);
-        sessionThread.detach();
+    if (m_maxSessions && m_sessionCount >= m_maxSessions)
+    {
+        LOG_WARNING(0, 0, 0, "session refused, too many sessions");
+        sessionSocket->Close();
+        return;
     }
+
+    m_sessionCount++;
+    uint64_t sessionId = ++m_lastSessionId;
+    {
+        // duplicate stays valid even after the session closes its socket, shutting it down can't hit the reused one
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        m_sessionHandles[sessionId] = dup(sessionSocket->GetHandle());
+    }
+
+    std::thread sessionThread([this, sessionSocket, sessionId]()
+    {
+        Logger::SetSession(sessionId);
+        ProcessSession(sessionSocket);
+
+        // notified under the lock, Run() may return and the server may be gone right after it is released
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        close(m_sessionHandles[sessionId]);
+        m_sessionHandles.erase(sessionId);
+        m_sessionCount--;
+        m_sessionsCondition.notify_all();
+    });
+    sessionThread.detach();
+}
+
+void Server::SetSendLimits(uint32_t bufferSize, uint32_t writeTimeout)
+{
+    m_sendBufferSize = bufferSize;
+    m_writeTimeout = writeTimeout;
+}
+
+void Server::SetMaxSessions(uint32_t maxSessions)
+{
+    m_maxSessions = maxSessions;
+}
+
+void Server::SetLocalPath(const std::string& path)
+{
+    m_localPath = path;
+}
+
+void Server::SetFastOpen(bool fastOpen)
+{
+    m_fastOpen = fastOpen;
+}
+
+void Server::SetBlockCache(uint64_t memoryBudget, bool hugePages)
+{
+    m_blockCache.reset(memoryBudget ? new BlockCache(memoryBudget, hugePages) : nullptr);
+}
+
+const BlockCache* Server::GetBlockCache() const
+{
+    return m_blockCache.get();
+}
+
+void Server::SetUncachedThreshold(uint64_t fileSize)
+{
+    m_uncachedThreshold = fileSize;
+}
+
+void Server::SetListenerShards(uint32_t shardCount)
+{
+    m_listenerShards = shardCount;
+}
+
+void Server::SetClientPriority(const std::string& address, PriorityClass priority)
+{
+    m_clientPriorities[address] = priority;
+}
+
+PriorityClass Server::GetSessionPriority(SocketPtr socket, uint8_t requestedPriority) const
+{
+    // priority configured for the client address takes precedence over the one the client asks for
+    auto itr = m_clientPriorities.find(socket->GetHostname());
+    if (itr != m_clientPriorities.end())
+        return itr->second;
+
+    if (requestedPriority == PRIORITY_DEFAULT || requestedPriority >= MAX_PRIORITY)
+        return PRIORITY_NORMAL;
+
+    return (PriorityClass)requestedPriority;
 }
 
 void Server::ProcessSession(SocketPtr socket)
 {
+    LogTimer sessionTimer;
+    LOG_INFO(0, 0, 0, "session from " + socket->GetHostname());
     try
     {
         socket->SetRecvTimeout(3, 0);
+        socket->SetNoDelay(true);
+        // client which stops reading is dropped after the write timeout instead of pinning the session forever
+        socket->SetSendLimits(m_sendBufferSize, m_writeTimeout);
         Packet* packet = nullptr;
 
         packet = ReceiveMessage(socket);
-        if (!HandleHandshakeRequest(socket, packet))
+        if (packet && packet->GetOpcode() == CMSG_HANDSHAKE_DOWNLOAD)
         {
-            socket->Close();
-            return;
+            // client sent the handshake together with the download request, skip the round trip
+            if (!HandleHandshakeDownload(socket, packet))
+            {
+                LOG_WARNING(CMSG_HANDSHAKE_DOWNLOAD, 0, 0, "invalid handshake download request");
+                socket->Close();
+                return;
+            }
         }
-
-        packet = ReceiveMessage(socket);
-        if (!HandleDownloadRequest(socket, packet))
+        else
         {
-            socket->Close();
-            return;
+            if (!HandleHandshakeRequest(socket, packet))
+            {
+                LOG_WARNING(CMSG_HANDSHAKE_REQUEST, 0, 0, "invalid handshake request");
+                socket->Close();
+                return;
+            }
+
+            packet = ReceiveMessage(socket);
+            if (!HandleDownloadRequest(socket, packet))
+            {
+                LOG_WARNING(CMSG_DOWNLOAD_REQUEST, 0, 0, "invalid download request");
+                socket->Close();
+                return;
+            }
         }
 
         packet = ReceiveMessage(socket);
         if (!HandleFarewell(socket, packet))
         {
+            LOG_WARNING(XMSG_FAREWELL, socket->GetBytesSent(), 0, "session ended without farewell");
             socket->Close();
             return;
         }
 
         socket->Close();
+        LOG_INFO(XMSG_FAREWELL, socket->GetBytesSent(), sessionTimer.GetDurationUs(), "session finished");
     }
     catch (const IPKException& ex)
     {
+        LOG_ERROR(0, socket->GetBytesSent(), sessionTimer.GetDurationUs(), ex.what());
         socket->Close();
     }
 }
@@ -82,10 +327,30 @@ bool Server::HandleHandshakeRequest(SocketPtr socket, Packet* packet)
     *packet >> magic;
     // TODO: check magic?
 
-    SendMessage(socket, SMSG_HANDSHAKE_RESPONSE, sizeof(uint16_t), (uint16_t)42);
+    SendMessage(socket, SMSG_HANDSHAKE_RESPONSE, sizeof(uint16_t), (uint16_t)SERVER_MAGIC);
     return true;
 }
 
+bool Server::HandleHandshakeDownload(SocketPtr socket, Packet* packet)
+{
+    if (!packet)
+        return false;
+
+    if (packet->GetOpcode() != CMSG_HANDSHAKE_DOWNLOAD)
+        return false;
+
+    uint16_t magic;
+    std::string filePath;
+    uint8_t requestedPriority, flags;
+    *packet >> magic >> filePath >> requestedPriority >> flags;
+
+    // there is no handshake response the client could check, so at least make sure it speaks our protocol
+    if (magic != CLIENT_MAGIC)
+        return false;
+
+    return SendFile(socket, filePath, requestedPriority, flags);
+}
+
 bool Server::HandleDownloadRequest(SocketPtr socket, Packet* packet)
 {
     if (!packet)
@@ -95,42 +360,142 @@ bool Server::HandleDownloadRequest(SocketPtr socket, Packet* packet)
         return false;
 
     std::string filePath;
-    *packet >> filePath;
-    // TODO: check?
+    uint8_t requestedPriority, flags;
+    *packet >> filePath >> requestedPriority >> flags;
 
-    std::ifstream file(filePath, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
-    bool result = file.good();
+    return SendFile(socket, filePath, requestedPriority, flags);
+}
+
+bool Server::SendFile(SocketPtr socket, const std::string& filePath, uint8_t requestedPriority, uint8_t flags)
+{
+    LogTimer sendTimer;
+    // TODO: check filePath?
+    int fileFd = open(filePath.c_str(), O_RDONLY);
+    struct stat fileStat;
+    bool result = (fileFd != -1) && (fstat(fileFd, &fileStat) == 0) && S_ISREG(fileStat.st_mode);
 
     uint64_t fileSize = 0;
     if (result)
-    {
-        fileSize = file.tellg();
-        file.seekg(0, std::ios_base::beg);
-    }
+        fileSize = fileStat.st_size;
 
     SendMessage(socket, SMSG_DOWNLOAD_RESPONSE, sizeof(uint8_t) + sizeof(uint64_t), (uint8_t)result, fileSize);
 
     if (!result)
+    {
+        LOG_WARNING(SMSG_DOWNLOAD_RESPONSE, 0, 0, "file not available: " + filePath);
+        if (fileFd != -1)
+            close(fileFd);
+        return true;
+    }
+
+    // same host client can read the file by itself, no data has to go through the socket
+    if (socket->IsLocal() && (flags & DOWNLOAD_FLAG_DESCRIPTOR))
+    {
+        Packet packet(SMSG_DOWNLOAD_DESCRIPTOR, 0);
+        try
+        {
+            socket->SendDescriptor(packet, fileFd);
+        }
+        catch (const IPKException& ex)
+        {
+            close(fileFd);
+            throw;
+        }
+
+        close(fileFd);
+        LOG_INFO(SMSG_DOWNLOAD_DESCRIPTOR, fileSize, sendTimer.GetDurationUs(), filePath);
         return true;
+    }
+
+    FileKey fileKey;
+    fileKey.device = fileStat.st_dev;
+    fileKey.inode = fileStat.st_ino;
+    fileKey.size = fileSize;
+    fileKey.modifyTime = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+
+    // cold file streamed once would only push the hot ones out of the page cache and the block cache, so it is read
+    // directly from the disk, or the pages it went through are dropped if the filesystem can't do that
+    bool uncached = (flags & DOWNLOAD_FLAG_UNCACHED) || (m_uncachedThreshold && fileSize >= m_uncachedThreshold);
+    std::unique_ptr<DirectFileReader> directReader(uncached ? new DirectFileReader(fileFd) : nullptr);
 
     uint64_t bytesSent = 0;
+    uint64_t dataEnd = 0;
     uint64_t chunkSize = ((m_speedLimit * IN_KILOBYTES) * ((double)DATA_SEND_DELAY / IN_MILLISECONDS) + 0.5);
     MsDelay delay(DATA_SEND_DELAY);
     char* buffer = new char[chunkSize];
-    while (bytesSent < fileSize)
+    uint32_t flowId = m_scheduler.RegisterFlow(GetSessionPriority(socket, requestedPriority));
+    try
     {
-        uint32_t bytes = std::min(fileSize - bytesSent, chunkSize);
-        file.read(buffer, bytes);
+        while (bytesSent < fileSize)
+        {
+            // we are at the end of the data extent, look for the next one and skip the hole before it,
+            // clients not knowing about holes get them as zeroes
+            if (bytesSent >= dataEnd)
+            {
+                uint64_t dataStart = bytesSent;
+                dataEnd = fileSize;
+                if (flags & DOWNLOAD_FLAG_SPARSE)
+                    FindDataExtent(fileFd, fileSize, bytesSent, dataStart, dataEnd);
+
+                if (dataStart > bytesSent)
+                {
+                    SendMessage(socket, SMSG_DOWNLOAD_HOLE, sizeof(uint64_t), dataStart - bytesSent);
+                    bytesSent = dataStart;
+                    continue;
+                }
+            }
+
+            // session speed limit is kept by the chunk size, the shared uplink is divided by the scheduler
+            uint32_t bytes = m_scheduler.Acquire(flowId, std::min(dataEnd - bytesSent, chunkSize));
+            if (uncached || !m_blockCache || !SendCachedData(socket, fileFd, fileKey, bytesSent, bytes))
+            {
+                bool read = directReader ? directReader->Read(buffer, bytes, bytesSent) : ReadFileAt(fileFd, buffer, bytes, bytesSent);
+                if (!read)
+                    throw IPKException("Server::SendFile - unable to read the file");
 
-        Packet packet(SMSG_DOWNLOAD_DATA, bytes);
-        packet.AppendBuffer((const uint8_t*)buffer, bytes);
-        SendMessage(socket, &packet);
+                socket->SendData(SMSG_DOWNLOAD_DATA, (const uint8_t*)buffer, bytes);
+            }
 
-        bytesSent += bytes;
+            bytesSent += bytes;
+
+            std::this_thread::sleep_for(delay);
+        }
+    }
+    catch (const IPKException& ex)
+    {
+        m_scheduler.UnregisterFlow(flowId);
+        delete[] buffer;
+        close(fileFd);
+        throw;
+    }
+
+    m_scheduler.UnregisterFlow(flowId);
+    delete[] buffer;
+    close(fileFd);
+    LOG_INFO(SMSG_DOWNLOAD_DATA, fileSize, sendTimer.GetDurationUs(), filePath);
+    return true;
+}
+
+bool Server::SendCachedData(SocketPtr socket, int fileFd, const FileKey& fileKey, uint64_t offset, uint32_t length)
+{
+    // data go to the socket straight from the cached blocks, they stay pinned until the send is done
+    BlockPins pins(*m_blockCache);
+    std::vector<iovec> parts;
+    for (uint64_t pos = offset; pos < offset + length; )
+    {
+        uint64_t blockOffset = pos % BLOCK_CACHE_BLOCK_SIZE;
+        const uint8_t* block = pins.Pin(fileFd, fileKey, pos / BLOCK_CACHE_BLOCK_SIZE);
+        if (!block)
+            return false;
 
-        std::this_thread::sleep_for(delay);
+        iovec part;
+        part.iov_base = const_cast<uint8_t*>(block + blockOffset);
+        part.iov_len = std::min<uint64_t>(BLOCK_CACHE_BLOCK_SIZE - blockOffset, offset + length - pos);
+        parts.push_back(part);
+        pos += part.iov_len;
     }
 
+    socket->SendData(SMSG_DOWNLOAD_DATA, parts.data(), parts.size(), length);
     return true;
 }
 
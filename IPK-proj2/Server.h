@@ -1,17 +1,24 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <map>
+#include <vector>
 #include <string>
+#include <mutex>
 #include <atomic>
 #include <chrono>
 #include <memory>
+#include <condition_variable>
 #include <cstdint>
 #include "Service.h"
-#include "Socket.h"
+#include "PacketSocket.h"
+#include "BandwidthScheduler.h"
+#include "BlockCache.h"
 
 #define DATA_SEND_DELAY     10
 #define IN_KILOBYTES        1000
 #define IN_MILLISECONDS     1000
+#define DEFAULT_WRITE_TIMEOUT   10000
 
 typedef std::chrono::duration<uint64_t, std::milli> MsDelay;
 
@@ -20,26 +27,67 @@ class Server : public Service
 public:
     Server() = delete;
     Server(const Server&) = delete;
-    Server(const std::string& hostname, uint16_t port, uint64_t speedLimit);
+    Server(const std::string& hostname, uint16_t port, uint64_t speedLimit, uint64_t uplinkLimit = 0);
 
     ~Server();
 
     void Run();
     void Stop();
 
+    void SetFastOpen(bool fastOpen);
+    void SetLocalPath(const std::string& path);
+    void SetSendLimits(uint32_t bufferSize, uint32_t writeTimeout);
+    void SetMaxSessions(uint32_t maxSessions);
+    void SetClientPriority(const std::string& address, PriorityClass priority);
+    // 0 means one listener per available core
+    void SetListenerShards(uint32_t shardCount);
+    // hot file content is served from the memory, 0 turns the cache off
+    void SetBlockCache(uint64_t memoryBudget, bool hugePages);
+    const BlockCache* GetBlockCache() const;
+    // files at least this large are read around the page cache as if the client asked for it, 0 turns it off
+    void SetUncachedThreshold(uint64_t fileSize);
+
     void ProcessSession(SocketPtr socket);
 
 protected:
     bool HandleHandshakeRequest(SocketPtr socket, Packet* packet);
     bool HandleDownloadRequest(SocketPtr socket, Packet* packet);
+    bool HandleHandshakeDownload(SocketPtr socket, Packet* packet);
     bool HandleFarewell(SocketPtr socket, Packet* packet);
 
+    void StartSession(SocketPtr sessionSocket);
+    bool SendFile(SocketPtr socket, const std::string& filePath, uint8_t requestedPriority, uint8_t flags);
+    // returns false if some of the blocks couldn't be cached, nothing is sent then
+    bool SendCachedData(SocketPtr socket, int fileFd, const FileKey& fileKey, uint64_t offset, uint32_t length);
+    PriorityClass GetSessionPriority(SocketPtr socket, uint8_t requestedPriority) const;
+
 private:
     Server& operator =(const Server&);
 
+    void AcceptLoop(uint32_t shard, int core);
+    static std::vector<int> GetAvailableCores();
+
     std::atomic_bool m_running;
     std::atomic_uint m_sessionCount;
+    // own descriptors of the session connections by the session id, so Run() can cut them off when it ends
+    std::map<uint64_t, int> m_sessionHandles;
+    std::mutex m_sessionsMutex;
+    std::condition_variable m_sessionsCondition;
+    std::atomic<uint64_t> m_lastSessionId;
     uint64_t m_speedLimit;
+    BandwidthScheduler m_scheduler;
+    std::map<std::string, PriorityClass> m_clientPriorities;
+    bool m_fastOpen;
+    std::string m_localPath;
+    SocketPtr m_localSocket;
+    uint32_t m_sendBufferSize;
+    uint32_t m_writeTimeout;
+    uint32_t m_maxSessions;
+    uint32_t m_listenerShards;
+    std::vector<SocketPtr> m_listeners;
+    int m_stopEvent;
+    std::unique_ptr<BlockCache> m_blockCache;
+    uint64_t m_uncachedThreshold;
 };
 
 #endif // SERVER_H
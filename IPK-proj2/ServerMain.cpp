@@ -1,6 +1,9 @@
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <utility>
 #include "Server.h"
+#include "Logger.h"
 #include "IPKException.h"
 
 #include <signal.h>
@@ -8,53 +11,145 @@ void dummySigPipe(int)
 {
 }
 
+Server* runningServer = nullptr;
+void stopServer(int)
+{
+    if (runningServer)
+        runningServer->Stop();
+}
+
 int main(int argc, char** argv)
 {
     signal(SIGPIPE, &dummySigPipe);
 
     try
     {
-        if (argc != 5)
-            throw IPKException("main - invalid count of parameters");
-
-        uint32_t portArg, speedLimitArg;
-        if (strcmp(argv[1], "-p") == 0)
+        // -p <port> -d <speed limit> [-u <uplink limit>] [-c <address>=<priority class>]... [-l <local socket>]
+        //    [-b <send buffer size>] [-w <write timeout>] [-m <max sessions>] [-n <listener shards>]
+        //    [-k <block cache size in MB>] [-o <uncached file size in MB>] [-L <log file>] [-H] [-B] [-f]
+        // -B writes the log as binary records
+        const char* portStr = nullptr;
+        const char* speedLimitStr = nullptr;
+        const char* uplinkLimitStr = nullptr;
+        const char* localPath = nullptr;
+        const char* logPath = nullptr;
+        uint32_t sendBufferSize = 0, writeTimeout = DEFAULT_WRITE_TIMEOUT, maxSessions = 0, listenerShards = 0;
+        uint64_t blockCacheSize = 0, uncachedThreshold = 0;
+        std::vector<std::pair<std::string, PriorityClass>> clientPriorities;
+        bool fastOpen = false, hugePages = false, binaryLog = false;
+        for (int i = 1; i < argc; ++i)
         {
-            if (strcmp(argv[3], "-d") == 0)
+            // all options except the flags have exactly one value
+            if (strcmp(argv[i], "-f") == 0)
             {
-                portArg = 2;
-                speedLimitArg = 4;
+                fastOpen = true;
+                continue;
             }
-            else
-                throw IPKException("main - invalid parameters");
-        }
-        else if (strcmp (argv[1], "-d") == 0)
-        {
-            if (strcmp(argv[3], "-p") == 0)
+            else if (strcmp(argv[i], "-H") == 0)
+            {
+                hugePages = true;
+                continue;
+            }
+            else if (strcmp(argv[i], "-B") == 0)
             {
-                portArg = 4;
-                speedLimitArg = 2;
+                binaryLog = true;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                throw IPKException("main - invalid count of parameters");
+
+            const char* option = argv[i];
+            const char* value = argv[++i];
+            if (strcmp(option, "-p") == 0 && !portStr)
+                portStr = value;
+            else if (strcmp(option, "-d") == 0 && !speedLimitStr)
+                speedLimitStr = value;
+            else if (strcmp(option, "-u") == 0 && !uplinkLimitStr)
+                uplinkLimitStr = value;
+            else if (strcmp(option, "-l") == 0 && !localPath)
+                localPath = value;
+            else if (strcmp(option, "-L") == 0 && !logPath)
+                logPath = value;
+            else if (strcmp(option, "-b") == 0)
+                std::stringstream(value) >> sendBufferSize;
+            else if (strcmp(option, "-w") == 0)
+                std::stringstream(value) >> writeTimeout;
+            else if (strcmp(option, "-m") == 0)
+                std::stringstream(value) >> maxSessions;
+            else if (strcmp(option, "-n") == 0)
+                std::stringstream(value) >> listenerShards;
+            else if (strcmp(option, "-k") == 0)
+                std::stringstream(value) >> blockCacheSize;
+            else if (strcmp(option, "-o") == 0)
+                std::stringstream(value) >> uncachedThreshold;
+            else if (strcmp(option, "-c") == 0)
+            {
+                const char* delim = strchr(value, '=');
+                if (!delim)
+                    throw IPKException("main - invalid client priority");
+
+                clientPriorities.push_back(std::make_pair(std::string(value, delim - value), ParsePriorityClass(delim + 1)));
             }
             else
                 throw IPKException("main - invalid parameters");
         }
-        else
+
+        if (!portStr || !speedLimitStr)
             throw IPKException("main - invalid parameters");
 
-        std::stringstream portStream(argv[portArg]);
-        std::stringstream speedLimitStream(argv[speedLimitArg]);
+        std::stringstream portStream(portStr);
+        std::stringstream speedLimitStream(speedLimitStr);
+        std::stringstream uplinkLimitStream(uplinkLimitStr ? uplinkLimitStr : "0");
         uint16_t port;
-        uint64_t speedLimit;
+        uint64_t speedLimit, uplinkLimit;
         portStream >> port;
         speedLimitStream >> speedLimit;
+        uplinkLimitStream >> uplinkLimit;
+
+        if (logPath)
+            Logger::Start(logPath, binaryLog);
+
+        Server server("0.0.0.0", port, speedLimit, uplinkLimit);
+        server.SetFastOpen(fastOpen);
+        server.SetSendLimits(sendBufferSize, writeTimeout);
+        server.SetMaxSessions(maxSessions);
+        server.SetListenerShards(listenerShards);
+        server.SetBlockCache(blockCacheSize * 1024 * 1024, hugePages);
+        server.SetUncachedThreshold(uncachedThreshold * 1024 * 1024);
+        if (localPath)
+            server.SetLocalPath(localPath);
+        for (auto itr = clientPriorities.begin(); itr != clientPriorities.end(); ++itr)
+            server.SetClientPriority(itr->first, itr->second);
+
+        // interrupted server closes its listeners and the local socket and cuts off the sessions before it exits
+        runningServer = &server;
+        signal(SIGINT, &stopServer);
+        signal(SIGTERM, &stopServer);
+        try
+        {
+            server.Run();
+        }
+        catch (const IPKException&)
+        {
+            runningServer = nullptr;
+            throw;
+        }
+
+        runningServer = nullptr;
 
-        Server server("0.0.0.0", port, speedLimit);
-        server.Run();
+        if (const BlockCache* blockCache = server.GetBlockCache())
+            std::cout << "Block cache: " << blockCache->GetHits() << " hits, " << blockCache->GetMisses() << " misses" << std::endl;
+        if (Logger::GetDropped())
+            std::cout << "Log: " << Logger::GetDropped() << " records dropped" << std::endl;
     }
     catch(const IPKException& ex)
     {
+        LOG_ERROR(0, 0, 0, ex.what());
         std::cerr << ex.what() << std::endl;
     }
 
+    Logger::Stop();
+
     return 0;
 }
@@ -2,15 +2,17 @@
 #define SERVICE_H
 
 #include <cstdint>
-#include "Socket.h"
+#include "PacketSocket.h"
 #include "Packet.h"
+#include "Logger.h"
 
 class Service
 {
 public:
     Service() = delete;
     Service(const Service&) = delete;
-    Service(const std::string& hostname, uint16_t port) : m_socket(new Socket(hostname, port)) { }
+    Service(const std::string& hostname, uint16_t port) : m_socket(new PacketSocket(hostname, port)) { }
+    Service(PacketSocket* socket) : m_socket(socket) { }
     ~Service() { }
 
     virtual void Run() = 0;
@@ -50,6 +52,9 @@ protected:
                 return nullptr;
         }
 
+        if (packet)
+            LOG_DEBUG(packet->GetOpcode(), packet->GetLength(), 0, "packet received");
+
         return packet;
     }
 